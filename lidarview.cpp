@@ -1,1140 +1,6223 @@
-/* lidarview file.txt
-
-   Reads a lidar point cloud in txt form and renders the points in
-   3D. Has options to filter by first and last return, and number of
-   returns; has options to filter by classification codes (ground,
-   building, vegetation and other).
-
-   The lidar file is obtained from a .las or .laz file with
-   LAStools:las2txt;
-
-   last2txt -o file.las -o file.txt -parse xyznrc
-
-   NOTE: -parse xyznrc in this order
-
-   keypress:
-
-   l/r/u/d/f/bx/X,y/Y,z/Z: translate and rotate
-   w: toggle wire/filled polygons
-   v,g,h,o: toggle veg, ground, buildings,other on/off
-   c: cycle through colormaps (one color, based on code, based on your code)
-   t: cycle through filter  options: first-return, lsat return, many-returns, all-returns
-
-   OpenGL 1.x
-   Laura Toma
-*/
-
-#include <stdlib.h>
-#include <stdio.h>
-#include <math.h>
-#include <assert.h>
-#include <iostream>
-#include <queue>
-
-//this allows this code to compile both on apple and linux platforms
-#ifdef __APPLE__
-#include <GLUT/glut.h>
-#else
-#include <GL/glut.h>
-#endif
-#include <vector>
-#include <math.h>
-
-using namespace std;
-
-typedef struct _lidarPoint {
-  float x,y,z;
-  int nb_of_returns; //how many returns this pulse has
-  int return_number; //the number of this return
-  int code;  //classification code read from file
-
-  int mycode; //classification code assigned by us
-} lidarPoint;
-
-class Point{
-public:
-  float x, y, z;
-  Point(float i, float j, float k): x(i), y(j), z(k) {}
-};
-
-//the array of lidar points; note: this needs to be global because it
-//needs to be rendered
-vector<lidarPoint>  points;
-
-//bounding box of the points, updated when the terrain is loaded from file
-float minx, maxx, miny, maxy, minz, maxz;
-const int NODATA = -9999;
-const int WINDOWSIZE = 500;
-const int BIGINT = 0x0fffffff;
-
-//for hill shade
-vector<vector<float> > elevation;
-float min_elevation; //This is used instead of the minz value since
-		     //minz is affected by weird LIDAR noise.
-Point sun_incidence(0.577, 0.577, -0.577); //sun vector
-
-//for ground find
-vector<vector<float> > last_grid;
-vector<vector<int> > is_ground;
-vector<vector<int> > find_ground();
-float building_slope_threshold = 0.5;
-
-
-int point_density = 5; //average points per grid cell
-
-//whenever the user rotates and translates the scene, we update these
-//global translation and rotation
-GLfloat pos[3] = {0,0,0};
-GLfloat theta[3] = {0,0,0};
-
-// draw polygons line or filled. This will be used when rendering the
-// surface.
-GLint fillmode = 0;
-
-
-/* ************************************************************ */
-/* FILTERING POINTS BY THEIR RETURN SITUATION */
-/* A LiDAR point has a return number and a number of returns (for its
-   pulse).  A pulse may get several returns over vegetation, lets say
-   3, and this will result in three points:
-
-   return number/number of returns
-   1/3 x y z
-   2/3 x y z
-   3/3 x y z
-   note the x,y,z may be different for different return numbers
-
-   For bare earth, you will only have one return:
-   1/1
-
-
-   If ALL_RETURN, all points  are included
-   IF FIRST_RETURN, only the first returns are included, ie points with return number=1
-
-   If LAST_RETURN, only the last returns are included, i.e points with
-   1/1 and points with 2/2 or 3/3 or 4/4
-*/
-#define ALL_RETURN 0
-#define FIRST_RETURN 1
-#define LAST_RETURN 2
-#define MORE_THAN_ONE_RETURN 3
-#define NB_WHICH_RETURN_OPTIONS 4
-// WHICH_RETURN  cycles through all options via keypress 'm'
-int WHICH_RETURN = ALL_RETURN;
-
-
-
-/* ************************************************************ */
-/* FILTERING POINTS BY THEIR classification code */
-/*
-lidar classification codes  [from ...somewhere on internet]
-
-0 never classified
-1 unassigned
-2 ground
-3 low vegetation
-4 medium vegetation
-5 high vegetation
-6 building
-7 low point (noise)
-8 model key-point (mass point)
-9 water
-10 railroad
-11 road
-12 overlap
-13 wire-guard (shield)
-14 wire-conductor (phase)
-15 transmission tower
-17 bridge
-18 hight point (noise)
-19-255 reserved for asprs definition
- */
-
-//These are used by render() to decide  what points to render.
-//By default draw everything; each one of these classes can be toggled
-//on/off in keypress()
-int GROUND=1;
-int VEG=1;
-int BUILDING=1;
-int OTHER=1;
-int HILL_SHADE = 1;
-
-
-/* **************************************** */
-/* chosing a color map:
-g
-   If COLORMAP == ONE_COLOR:  draw all filtered points in one color
-
-   If COLORMAP == CODE_COLOR: draw all filtered points with a color
-   based on their classification code p.code which was read from the
-   las file
-
-   If COLORMAP == MYCODE_COLOR:  draw all filtered points with a color
-   based on their classification code p.mycode which we computed
-
-   COLORMAP starts by default as ONE_COLOR and cycles through all
-   options via keypress 'c'.
-*/
-#define ONE_COLOR 0
-#define CODE_COLOR 1
-#define MYCODE_COLOR 2
-#define NB_COLORMAP_CHOICES 3
-int COLORMAP = ONE_COLOR;
-
-
-
-//predefine some colors for convenience
-GLfloat red[3] = {1.0, 0.0, 0.0};
-GLfloat green[3] = {0.0, 1.0, 0.0};
-GLfloat blue[3] = {0.0, 0.0, 1.0};
-GLfloat black[3] = {0.0, 0.0, 0.0};
-GLfloat white[3] = {1.0, 1.0, 1.0};
-GLfloat gray[3] = {0.5, 0.5, 0.5};
-GLfloat yellow[3] = {1.0, 1.0, 0.0};
-GLfloat magenta[3] = {1.0, 0.0, 1.0};
-GLfloat cyan[3] = {0.0, 1.0, 1.0};
-
-/* from https://www.opengl.org/discussion_boards/showthread.php/132502-Color-tables  */
-GLfloat brown[3] = { 0.647059, 0.164706, 0.164706};
-GLfloat DarkBrown[3] = { 0.36, 0.25, 0.20};
-GLfloat DarkTan[3] = { 0.59, 0.41, 0.31};
-GLfloat Maroon[3]= { 0.556863, 0.137255, 0.419608};
-GLfloat DarkWood[3] = { 0.52, 0.37, 0.26};
-
-GLfloat  Copper[3] = { 0.72,  0.45,  0.20};
-
-GLfloat green1[3] = {.5, 1, 0.5};
-GLfloat green2[3] = {0.0, .8, 0.0};
-GLfloat green3[3] = {0.0, .5, 0.0};
-GLfloat ForestGreen[3] = { 0.137255, 0.556863, 0.137255};
-GLfloat MediumForestGreen[3] = { 0.419608 , 0.556863 , 0.137255};
-GLfloat LimeGreen[3] ={ 0.196078,  0.8 , 0.196078};
-
-GLfloat Orange[3] = { 1, .5, 0};
-GLfloat Silver[3] = { 0.90, 0.91, 0.98};
-GLfloat Wheat[3] = { 0.847059 , 0.847059, 0.74902};
-
-
-/* forward declarations of functions */
-void display(void);
-void keypress(unsigned char key, int x, int y);
-
-void draw_hill_shade();
-void draw_ground();
-void draw_xy_rect(GLfloat z, GLfloat* col);
-void draw_xz_rect(GLfloat y, GLfloat* col);
-void draw_yz_rect(GLfloat x, GLfloat* col);
-void cube(GLfloat side);
-void filledcube(GLfloat side);
-void draw_axes();
-
-//reads the points from file in global array points
-void readPointsFromFile(char* fname);
-
-//FUNCTIONS CREATED BY ETHAN AND JAKE
-//puts points into elevation grid
-void gridify(){
-  int num_cells = points.size()/point_density;
-
-  //bounding box size
-  float h = maxy - miny;
-  float w  = maxx - minx;
-
-  //average grid square length
-  float delta = sqrt(h*w/float(num_cells));
-
-  int rows = ceil(h/delta);
-  int cols = ceil(w/delta);
-
-  //temporary height grid vectors, holds multiple height values per grid cell
-  vector< vector< vector<float> > >first_returns(rows,
-						   vector< vector<float> >(cols, vector<float>()));
-  vector< vector< vector<float> > >last_returns(rows,
-						   vector< vector<float> >(cols, vector<float>()));
-
-  //put FIRST RETURN and LAST RETURN lidar points into their grids
-  for(unsigned int i = 0; i < points.size(); i++) {
-    lidarPoint p = points[i];
-
-    int r = floor((p.y - miny)/delta);
-    int c = floor((p.x - minx)/delta);
-
-    if(p.return_number == 1){
-      first_returns[r][c].push_back(p.z);
-    }
-
-    if(p.return_number == p.return_number){
-      last_returns[r][c].push_back(p.z);
-    }
-  }
-
-  vector< vector<float> > avg_height(rows, vector<float>(cols, NODATA));
-  vector< vector<float> > avg_depth(rows, vector<float>(cols, NODATA));
-
-  //initialize to a large z
-  min_elevation = maxz;
-
-  //average out all points in each grid cell, for first and last
-  //return grids
-  for(unsigned int i = 0; i < first_returns.size(); i++) {
-    for(unsigned int j = 0; j < first_returns.size(); j++) {
-      float height_sum = 0;
-      float depth_sum = 0;
-      unsigned int k = 0;
-      unsigned int l = 0;
-
-      //sum all points in the both grids
-      for(k = 0; k < first_returns[i][j].size(); k++) {
-	height_sum += first_returns[i][j][k];
-      }
-      for(l = 0; l < last_returns[i][j].size(); l++) {
-	depth_sum += last_returns[i][j][l];
-      }
-
-      //use the counter of the above for loop to tell if there were
-      //any points in the current grid cell. If there are, set
-      //elevation equal to average of the points in this grid cell.
-      if(k > 0) {
-	avg_height[i][j] = height_sum/k;
-      }
-
-      if(l > 0) {
-	avg_depth[i][j] = depth_sum/l;
-      }
-
-
-      //find the lowest average ground point. This is used instead of
-      //the min_z value since min_z is affected by weird LIDAR noise.
-      if(avg_height[i][j] != NODATA &&
-	 avg_height[i][j] < min_elevation) {
-	min_elevation = avg_height[i][j];
-      }
-    }
-  }
-
-  elevation = avg_height;
-  last_grid = avg_depth;
-  //find the ground
-  is_ground = find_ground();
-}
-
-
-
-/* NOTE: file.txt must be obtained from file.las with las2txt with
-   -parse xyznrc in this order
-
-   last2txt -o file.las -o file.txt -parse xyznrc
- */
-//reads the points from file in global array points
-void readPointsFromFile(char* fname) {
-
-  FILE* file = fopen(fname, "r");
-  if (!file) {
-    printf("cannot open file %s\n",  fname);
-    exit(1);
-  }
-
-  lidarPoint p;
-  while (1) {
-    //-parse xyzcr
-    if (fscanf(file, "%f %f %f %d %d %d",
-	       &p.x, &p.y, &p.z, &p.nb_of_returns, &p.return_number, &p.code) <6)  break;
-
-    //else: if we are here,  we got another point
-    //printf("reading %f, %f, %f\n", p.x, p.y, p.z);
-
-
-    //insert the point in points[] array
-    p.mycode=0; //everything unclassified
-    points.push_back(p);
-
-    //update bounding box
-    if (points.size() == 1) {
-      minx=maxx = p.x;
-      miny=maxy = p.y;
-      minz=maxz = p.z;
-    } else {
-      if (minx > p.x) minx=p.x;
-      if (maxx < p.x) maxx = p.x;
-      if (miny > p.y) miny=p.y;
-      if (maxy < p.y) maxy = p.y;
-      if (minz > p.z) minz=p.z;
-      if (maxz < p.z) maxz = p.z;
-    }
-  } //while
-
-  fclose(file);
-
-  //print info
-  printf("total %d points in  [%f, %f], [%f,%f], [%f,%f]\n",
-	 (int)points.size(), minx, maxx, miny,maxy, minz, maxz);
-  gridify();
-}
-
-
-
-int main(int argc, char** argv) {
-  //read number of points from user
-  if (argc!=4) {
-    printf("usage: %s <file>.txt <density> <building slope threshold>\n", argv[0]);
-    exit(1);
-  }
-  //this allocates and initializes the array that holds the points
-  point_density = atoi(argv[2]);
-  building_slope_threshold = atof(argv[3]);
-
-  readPointsFromFile(argv[1]);
-
-  /* OPEN GL STUFF */
-  /* open a window and initialize GLUT stuff */
-  glutInit(&argc, argv);
-  glutInitDisplayMode(GLUT_SINGLE | GLUT_RGB | GLUT_DEPTH);
-  glutInitWindowSize(WINDOWSIZE, WINDOWSIZE);
-  glutInitWindowPosition(100,100);
-  glutCreateWindow(argv[0]);
-
-  /* register callback functions */
-  glutDisplayFunc(display);
-  glutKeyboardFunc(keypress);
-
-  /* OpenGL init */
-  /* set background color black*/
-  glClearColor(0, 0, 0, 0);
-  glEnable(GL_DEPTH_TEST);
-
-  // //CAMERA ANGLE CODE
-  // //CAMERA ANGLE CODE
-  // //CAMERA ANGLE CODE
-  // // setup the camera (i.e. the projection transformation)
-  // glMatrixMode(GL_PROJECTION);
-  // glLoadIdentity();
-  // gluPerspective(60, 1 /* aspect */, 1, 10.0); /* the frustrum is from z=-1 to z=-10 */
-  // /* camera is at (0,0,0) looking along negative z axis */
-
-  // //initialize the translation to bring the points in the view frustrum which is [-1, -10]
-  // pos[2] = -2;
-
-  // //initialize rotation to look at it from above
-  // theta[0] = -45;
-
-
-  /* start the event handler */
-  glutMainLoop();
-
-  return 0;
-}
-
-
-
-
-/* this function is called whenever the window needs to be rendered */
-void display(void) {
-
-  //clear the screen
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-  //clear all modeling transformations
-  glMatrixMode(GL_MODELVIEW);
-  glLoadIdentity();
-
-  /* The default GL window is x=[-1,1], y= [-1,1] with the origin in
-     the center.  The view frustrum was set up from z=-1 to z=-10. The
-     camera is at (0,0,0) looking along negative z axis.
-  */
-
- /* First we translate and rotate our local reference system with the
-    user transformation. pos[] represents the cumulative translation
-    entered by the user, and theta[] the cumulative rotation entered
-    by the user */
-  glTranslatef(pos[0], pos[1], pos[2]);
-  glRotatef(theta[0], 1,0,0); //rotate theta[0] around x-axis, etc
-  glRotatef(theta[1], 0,1,0);
-  glRotatef(theta[2], 0,0,1);
-
-  /* We translated the local reference system where we want it to be; now we draw the
-     object in the local reference system.  */
-
-  if (HILL_SHADE) {
-      draw_ground();
-    }
-    else {
-      draw_hill_shade();
-    }
-
-  //don't need to draw a cube but I found it nice for perspective
-  //  cube(1); //draw a cube of size 1
-
-  glFlush();
-}
-
-
-
-/* this function is called whenever  key is pressed */
-void keypress(unsigned char key, int x, int y) {
-  switch(key) {
-  case 's':
-    HILL_SHADE = !HILL_SHADE;
-    glutPostRedisplay();
-    break;
-
-  case '+':
-    building_slope_threshold += 0.05;
-    cout << "Building slope threshold is now: " <<
-      building_slope_threshold << endl;
-
-    is_ground = find_ground();
-    glutPostRedisplay();
-    break;
-
-  case '-':
-    building_slope_threshold -= 0.05;
-    cout << "Building slope threshold is now: " <<
-      building_slope_threshold << endl;
-
-    is_ground = find_ground();
-    glutPostRedisplay();
-    break;
-
-  case '2':
-    //3d orthogonal projection, view from straight above
-    glMatrixMode(GL_PROJECTION);
-    //the view frustrum is z=[0, -20]
-    glOrtho(-1, 1, -1, 1, 0,-20); //left, right, top, bottom, near, far
-
-    //initial view is from (0,0,-5) ie above the terrain looking straight down
-    pos[0]=pos[1]=0; pos[2] = -7;
-    //initial view: no rotation
-    theta[0]=theta[1] = theta[2]= 0;
-    glutPostRedisplay();
-    break;
-
-  case '3':
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    gluPerspective(60, 1 /* aspect */, 1, 10.0); /* the frustrum is from z=-1 to z=-10 */
-    /* camera is at (0,0,0) looking along negative z axis */
-    //initialize the translation; view frustrum is z= [-1, -10] and
-    //initial position (0,0,-2)
-    pos[0]=pos[1]=0; pos[2] = -2;
-    //initialize rotation to look  from above
-    theta[1] = theta[2] = 0;  theta[0] = -45;
-    glutPostRedisplay();
-    break;
-
-  case 'c':
-    //change the colormap
-    COLORMAP= (COLORMAP+1) % NB_COLORMAP_CHOICES;
-    switch (COLORMAP) {
-    case ONE_COLOR:
-      printf("colormap: one color\n");
-      break;
-    case CODE_COLOR:
-      printf("colormap: by code\n");
-      break;
-    case MYCODE_COLOR:
-      printf("colormap: by mycode\n");
-      break;
-    default:
-      printf("colormap: unknown. oops, something went wrong.\n");
-      exit(1);
-    }
-    glutPostRedisplay();
-    break;
-
-  case 't':
-    //render points with one/more than one return
-    WHICH_RETURN = (WHICH_RETURN + 1) % NB_WHICH_RETURN_OPTIONS;
-    switch (WHICH_RETURN) {
-    case ALL_RETURN:
-      printf("draw all returns\n");
-      break;
-    case FIRST_RETURN:
-      printf("draw only first return (i.e.points with return_number=1)\n");
-      break;
-    case LAST_RETURN:
-      printf("draw only last return (i.e. points with return_number = number_of_returns)\n");
-      break;
-    case MORE_THAN_ONE_RETURN:
-      printf("draw only points that has >1 returns\n");
-      break;
-    default:
-      break;
-    }
-    glutPostRedisplay();
-    break;
-
-  case 'g':
-    //toggle off rendering ground points   (code=2)
-    GROUND = !GROUND;
-    glutPostRedisplay();
-    break;
-
-  case 'v':
-    //toggle off rendering vegetation points  (code=3,4,5)
-    VEG = !VEG;
-    glutPostRedisplay();
-    break;
-
-  case 'h':
-    //toggle off rendering building points  (code=6)
-    BUILDING = !BUILDING;
-    glutPostRedisplay();
-    break;
-
-  case 'o':
-    //toggle off rendering "other" ie points that are not ground, vegetation or building
-    OTHER=!OTHER;
-    glutPostRedisplay();
-    break;
-
-    //ROTATIONS
-  case 'x':
-    theta[0] += 5.0;
-    glutPostRedisplay();
-    break;
-  case 'y':
-    theta[1] += 5.0;
-    glutPostRedisplay();
-    break;
-  case 'z':
-    theta[2] += 5.0;
-    glutPostRedisplay();
-    break;
-  case 'X':
-    theta[0] -= 5.0;
-    glutPostRedisplay();
-    break;
-  case 'Y':
-    theta[1] -= 5.0;
-    glutPostRedisplay();
-    break;
-  case 'Z':
-    theta[2] -= 5.0;
-    glutPostRedisplay();
-    break;
-
-    //TRANSLATIONS
-    //backward (zoom out)
-  case 'b':
-    pos[2] -= 0.1;
-    glutPostRedisplay();
-    break;
-    //forward (zoom in)
-  case 'f':
-    pos[2] += 0.1;
-    //glTranslatef(0,0, 0.5);
-    glutPostRedisplay();
-    break;
-    //down
-  case 'd':
-     pos[1] -= 0.1;
-    //glTranslatef(0,0.5,0);
-    glutPostRedisplay();
-    break;
-    //up
-  case 'u':
-    pos[1] += 0.1;
-    //glTranslatef(0,-0.5,0);
-    glutPostRedisplay();
-    break;
-    //left
-  case 'l':
-    pos[0] -= 0.1;
-    glutPostRedisplay();
-    break;
-    //right
-  case 'r':
-    pos[0] += 0.1;
-    glutPostRedisplay();
-    break;
-
-    //fillmode
-  case 'w':
-    fillmode = !fillmode;
-     glutPostRedisplay();
-    break;
-
-  case 'q':
-    exit(0);
-    break;
-  }
-}//keypress
-
-
-
-
-
-
-
-
-
-/* x is a value in [minx, maxx]; it is mapped to [-1,1] */
-GLfloat xtoscreen(GLfloat x, int num_cols) {
-  //return (-1 + 2*x/WINDOWSIZE);
-  return (-1 + 2*(x)/float(num_cols));
-}
-
-
-/* y is a value in [miny, maxy]; it is mapped to [-1,1] */
-GLfloat ytoscreen(GLfloat y, int num_rows) {
-  return (-1 + 2*(y)/float(num_rows));
-}
-
-/* z is a value in [minz, maxz]; it is mapped so that [0, maxz] map to [0,1] */
-GLfloat ztoscreen(GLfloat z) {
-    return (-1 + 2*(z-minz)/(maxz-minz))/1.5;
-}
-
-
-//set color based on p.code
-void setColorByCode(lidarPoint p) {
-  switch (p.code) {
-  case 0: //never classified
-    glColor3fv(yellow);
-    break;
-  case 1: //unnasigned
-    glColor3fv(Orange);
-    break;
-  case 2: //ground
-    //    glColor3fv(DarkWood);
-    glColor3fv(DarkBrown);
-    break;
-  case 3: //low vegetation
-    glColor3fv(LimeGreen);
-    break;
-  case 4: //medium vegetation
-    glColor3fv(MediumForestGreen);
-    break;
-  case 5: //high vegetation
-    glColor3fv(ForestGreen);
-    break;
-  case 6: //building
-    //glColor3fv(Tan);
-    glColor3fv(Copper);
-    break;
-  case 7: //noise
-    glColor3fv(magenta);
-    break;
-  case 8: //reserved
-    glColor3fv(white);
-    break;
-  case 9: //water
-    glColor3fv(blue);
-    break;
-  case 10: //rail
-    glColor3fv(gray);
-    break;
-  case 11: //road surface
-    glColor3fv(gray);
-    break;
-  case 12:  //reserved
-    glColor3fv(white);
-    break;
-  case 13:
-  case 14: //wire
-    glColor3fv(gray);
-    break;
-  case 15: //transmission tower
-    glColor3fv(Wheat);
-    break;
-  case 16: //wire
-  case 17: //bridge deck
-    glColor3fv(blue);
-    break;
-  case 18: //high noise
-    glColor3fv(magenta);
-    break;
-  default:
-    printf("panic: encountered unknown code >18");
-  }
-} //setColorByCode
-
-
-
-//put your own colormap here  based on p.mycode
-void setColorByMycode(lidarPoint p) {
-
-  glColor3fv(blue);
-}
-
-//draw everything with one color
-void  setColorOneColor(lidarPoint p) {
-
-   glColor3fv(yellow); //yellow should be a constant...
-  return;
-}
-
-
-
-//point p has passed all the filters and must be rendered. Set its
-//color.
-void setColor(lidarPoint p) {
-
-  if (COLORMAP == ONE_COLOR) {
-    //draw all points with same color
-    setColorOneColor(p);
-
-  } else if (COLORMAP == MYCODE_COLOR) {
-    setColorByCode(p);
-
-  } else if (COLORMAP == CODE_COLOR) {
-    setColorByMycode(p);
-
-  } else {
-    printf("unkown colormap options.oops.\n");
-    exit(1);
-  }
-} //setColor()
-
-//calculates how bright a triangle should be, based on how much it
-//faces the sun. Uses the dot product between the incident sun vector
-//and the normal vector of the triangle.
-void hill_shade(Point p1, Point p2, Point p3, GLfloat* shade){
-  //calculate normal vector from triangle
-  Point U(p2.x - p1.x, p2.y - p1.y, p2.z - p1.z);
-  Point V(p3.x - p1.x, p3.y - p1.y, p3.z - p1.z);
-  Point N(U.y*V.z - U.z*V.y, U.z*V.x-U.x*V.z, U.x*V.y - U.y*V.x);
-
-  //normalize N:
-  float n_len = sqrt(N.x*N.x + N.y*N.y + N.z*N.z);
-  N.x = N.x/n_len;
-  N.y = N.y/n_len;
-  N.z = N.z/n_len;
-
-  //calculate dot product between sun vector and normal vector
-  float dot_product =
-    N.x*sun_incidence.x + N.y*sun_incidence.y + N.z*sun_incidence.z;
-
-  shade[0] = dot_product;
-  shade[1] = dot_product;
-  shade[2] = dot_product;
-}
-
-/* ****************************** */
-/* Draw the array of points stored in global variable elevation, and
-   hill shade it.
-
-   NOTE: The points are in the range x=[minx, maxx], y=[miny,
-   maxy], z=[minz, maxz] and they must be mapped into
-   x=[-1,1], y=[-1, 1], z=[-1,1]
-  */
-void draw_hill_shade(){
-  int num_rows = elevation.size();
-  int num_cols = elevation[0].size();
-
-  //draw two triangles for each grid cell. shade with hill_shade
-  //dot product calculation.
-  glBegin(GL_TRIANGLES);
-  for (unsigned int i=0; i < elevation.size()-1; i++) {
-    for (unsigned int j=0; j < elevation[i].size()-1; j++) {
-      //get the four heights of the cell
-      float h = elevation[i][j];
-      float h_i = elevation[i+1][j];
-      float h_j = elevation[i][j+1];
-      float h_2 = elevation[i+1][j+1];
-
-      //triangle 1
-      Point p1(float(i+1), float(j), h_i);
-      Point p2(float(i), float(j), h);
-      Point p3(float(i), float(j+1), h_j);
-
-      GLfloat shade[3];
-      hill_shade(p1, p2, p3, shade);
-
-      //if NODATA, make triangle a different color
-      if(h == NODATA || h_i == NODATA || h_j == NODATA){
-	h = min_elevation;
-	h_i = min_elevation;
-	h_j = min_elevation;
-	shade[0] = 1.0;
-	shade[1] = 0.0;
-	shade[2] = 0.6;
-      }
-
-      //draw triangle
-      glColor3fv(shade);
-      glVertex3f(xtoscreen(i, num_cols),
-      		 ytoscreen(j, num_rows),
-      		 ztoscreen(h));
-
-      glVertex3f(xtoscreen(i+1, num_cols),
-      		 ytoscreen(j, num_rows),
-      		 ztoscreen(h_i));
-
-      glVertex3f(xtoscreen(i, num_cols),
-      		 ytoscreen(j+1, num_rows),
-      		 ztoscreen(h_j));
-
-
-      //triangle 2
-      Point pa(float(i+1), float(j+1), h_2);
-      Point pb(float(i+1), float(j), h_i);
-      Point pc(float(i), float(j+1), h_j);
-
-      hill_shade(pa, pb, pc, shade);
-
-      //if NODATA, make triangle a different color
-      if(h_2 == NODATA || h_i == NODATA || h_j == NODATA){
-	h_i = min_elevation;
-	h_j = min_elevation;
-	h_2 = min_elevation;
-	shade[0] = 1.0;
-	shade[1] = 0.0;
-	shade[2] = 0.6;
-      }
-
-      //draw second triangle
-      glColor3fv(shade);
-      glVertex3f(xtoscreen(i+1, num_cols),
-		 ytoscreen(j, num_rows),
-		 ztoscreen(h_i));
-
-      glVertex3f(xtoscreen(i, num_cols),
-		 ytoscreen(j+1, num_rows),
-		 ztoscreen(h_j));
-
-      glVertex3f(xtoscreen(i+1, num_cols),
-		 ytoscreen(j+1, num_rows),
-		 ztoscreen(h_2));
-    }
-  }
-  glEnd();
-}//draw_hill_shade
-
-//note to self: can make this short to save memory
-//Finds possible ground points using BFS.
-//
-//The BFS starts at the lowest unsearched point, and considers that
-//point "ground". The BFS continues in all directions, until it
-//encounters a large slope, labeling this point building. The BFS
-//continues, labeling all children of this building point building as
-//well, until it encounters a large negative slope. Upon encountering
-//this large negative slope, the BFS terminates. The BFS also
-//terminates upon encountering already classified points.
-//
-//This procedure is then repeated, starting from the next lowest
-//unsearched point, until all points are classified.
-vector<vector<int> > find_ground() {
-  int num_rows = last_grid.size();
-  int num_cols = last_grid[0].size();
-
-  //initialize everything to -1, for unvisited
-  vector<vector<int> > is_ground(num_rows, vector<int>(num_cols, -1));
-  queue<Point> q;
-
-  //keep track of number of unclassified points
-  int unclassified_count = num_rows*num_cols;
-
-  //take out nodata points
-  for (unsigned int i=0; i < last_grid.size(); i++)
-    for (unsigned int j=0; j < last_grid[i].size(); j++)
-      if (last_grid[i][j] == NODATA)
-	unclassified_count--;
-
-  //loop until all points classified
-  do {
-    //find lowest UNCLASSIFIED ground point
-    float min_height = BIGINT;
-    int min_i = 0;
-    int min_j = 0;
-    for (unsigned int i=0; i < last_grid.size(); i++) {
-      for (unsigned int j=0; j < last_grid[i].size(); j++) {
-	if (last_grid[i][j] != NODATA &&
-	    is_ground[i][j] == -1 &&
-	    last_grid[i][j] < min_height) {
-	  min_height = last_grid[i][j];
-	  min_i = i;
-	  min_j = j;
-	}
-      }
-    }
-
-    //push lowest point into queue
-    q.push(Point(min_i, min_j, min_height));
-    is_ground[min_i][min_j] = 1;
-    unclassified_count--;
-
-    //do BFS
-    while(q.size()) {
-      Point current = q.front();
-      q.pop();
-      int curr_i = current.x;
-      int curr_j = current.y;
-      float curr_h = current.z;
-
-      bool curr_type = is_ground[curr_i][curr_j];
-
-      for (int di = -1; di <= 1; ++di) {
-	for (int dj = -1; dj <= 1; ++dj) {
-	  //look in compass directions
-	  if(di != dj && (di == 0 || dj == 0)) {
-	    //check if in bounds
-	    if(curr_i + di >= 0 && curr_j + dj >= 0 &&
-	       curr_i + di < last_grid.size() &&
-	       curr_j + dj < last_grid[0].size()) {
-
-	      int new_i = curr_i + di;
-	      int new_j = curr_j + dj;
-
-	      //if point is already visited, or new point is NODATA,
-	      //terminate this branch
-	      if(is_ground[new_i][new_j] != -1 ||
-		 last_grid[new_i][new_j] == NODATA) {
-		continue;
-	      }
-
-	      float new_h = last_grid[new_i][new_j];
-	      float slope = new_h - curr_h;
-
-	      //if gentle slope, new point is same type as current point
-	      if (slope <= building_slope_threshold && slope >= 0) {
-		q.push(Point(new_i, new_j, new_h));
-		is_ground[new_i][new_j] = curr_type;
-		unclassified_count--;
-	      }
-	      //if steep upwards slope, new point is building
-	      else if (slope > building_slope_threshold) {
-		q.push(Point(new_i, new_j, new_h));
-		is_ground[new_i][new_j] = 0;
-		unclassified_count--;
-	      }
-	      //if negative slope terminate this branch
-	      else if (slope < 0){
-		continue;
-	      }
-	    }// if in bounds check
-	  }// if compass direction
-	}// dj
-      }//di
-    }// while q not empty
-  } while(unclassified_count > 0);
-  return is_ground;
-}
-
-/* ****************************** */
-/* Draw the array of points stored in global variable last_grid,
-   and shade where the ground is.
-
-   NOTE: The points are in the range x=[minx, maxx], y=[miny,
-   maxy], z=[minz, maxz] and they must be mapped into
-   x=[-1,1], y=[-1, 1], z=[-1,1]
-  */
-void draw_ground(){
-  int num_rows = last_grid.size();
-  int num_cols = last_grid[0].size();
-
-  //draw two triangles for each grid cell. shade with hill_shade
-  //dot product calculation.
-  glBegin(GL_POINTS);
-  for (unsigned int i=0; i < last_grid.size(); i++) {
-    for (unsigned int j=0; j < last_grid[i].size(); j++) {
-      float h = last_grid[i][j];
-
-      //if NODATA, make triangle a different color
-      if(h == NODATA){
-	h = min_elevation;
-	glColor3fv(magenta);
-      }
-      else if(is_ground[i][j] == 1){
-      	glColor3fv(brown);
-      }
-      else if(is_ground[i][j] == 0){
-	glColor3fv(white);
-      }
-      else if(is_ground[i][j] == -1){
-	glColor3fv(green);
-      }
-
-      glVertex3f(xtoscreen(i, num_cols),
-		 ytoscreen(j, num_rows),
-		 ztoscreen(h));
-    }
-  }
-  glEnd();
-}//draw_ground
-
-//draw a square x=[-side,side] x y=[-side,side] at depth z
-void draw_xy_rect(GLfloat z, GLfloat side, GLfloat* col) {
-
-  glColor3fv(col);
-  glBegin(GL_POLYGON);
-  glVertex3f(-side,-side, z);
-  glVertex3f(-side,side, z);
-  glVertex3f(side,side, z);
-  glVertex3f(side,-side, z);
-  glEnd();
-}
-
-
-//draw a square y=[-side,side] x z=[-side,side] at given x
-void draw_yz_rect(GLfloat x, GLfloat side, GLfloat* col) {
-
-  glColor3fv(col);
-  glBegin(GL_POLYGON);
-  glVertex3f(x,-side, side);
-  glVertex3f(x,side, side);
-  glVertex3f(x,side, -side);
-  glVertex3f(x,-side, -side);
-  glEnd();
-}
-
-
-//draw a square x=[-side,side] x z=[-side,side] at given y
-void draw_xz_rect(GLfloat y, GLfloat side, GLfloat* col) {
-
-  glColor3fv(col);
-  glBegin(GL_POLYGON);
-  glVertex3f(-side,y, side);
-  glVertex3f(-side,y, -side);
-  glVertex3f(side,y, -side);
-  glVertex3f(side,y, side);
-  glEnd();
-}
-
-//draw a cube
-void cube(GLfloat side) {
-  GLfloat f = side, b = -side;
-
-  if (fillmode) {
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-  } else {
-    glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-  }
-
-
-  /* back face  BLUE*/
-  draw_xy_rect(b,side, blue);
- /* front face  RED*/
-  draw_xy_rect(f,side, red);
-  /* side faces  GREEN*/
-  draw_yz_rect(b, side, green);
-  draw_yz_rect(f, side, green);
-  //up, down faces missing to be able to see inside
-
-  /* middle z=0 face CYAN*/
-  draw_xy_rect(0, side, cyan);
-  /* middle x=0 face WHITE*/
-  draw_yz_rect(0,side, gray);
-  /* middle y=0 face  pink*/
-  draw_xz_rect(0, side, magenta);
-}
-
-
-
-//draw a filled cube  [-side,side]^3
-void filledcube(GLfloat side) {
-
-  glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-
-  /* back, front faces */
-  draw_xy_rect(-side,side, yellow);
-  draw_xy_rect(side,side, yellow);
-
-  /* left, right faces*/
-  draw_yz_rect(-side, side, yellow);
-  draw_yz_rect(side, side, yellow);
-
-  /* up, down  faces  */
-  draw_xz_rect(side,side, yellow);
-  draw_xz_rect(-side,side, yellow);
-}
+/* lidarview file.txt
+
+   Reads a lidar point cloud in txt form and renders the points in
+   3D. Has options to filter by first and last return, and number of
+   returns; has options to filter by classification codes (ground,
+   building, vegetation and other).
+
+   The lidar file is obtained from a .las or .laz file with
+   LAStools:las2txt;
+
+   last2txt -o file.las -o file.txt -parse xyznrc
+
+   NOTE: -parse xyznrc in this order
+
+   keypress:
+
+   l/r/u/d/f/bx/X,y/Y,z/Z: translate and rotate
+   w: toggle wire/filled polygons
+   p: toggle between the points and the grid views
+   i: toggle between the ground TIN (if built with -tin) and the grid views
+   a/A, e/E: rotate the sun, raise/lower the sun
+   n: cycle through 1, 4 and 8 blended suns
+   S: toggle cast shadows on the hill shade
+   k: cycle the hill shade: sun, sky view factor, both
+   j: toggle the viewshed overlay (if run with -viewshed or -observers)
+   C: toggle the contours (if run with -contours)
+   B: toggle the building footprints (if run with -buildings)
+   m: cycle the ground engine: BFS, morphological filter, cloth filter
+   +/-: raise/lower the threshold of the ground engine
+   v,g,h,o: toggle veg, ground, buildings,other on/off
+   c: cycle through colormaps (one color, based on code, based on your code)
+   t: cycle through filter  options: first-return, lsat return, many-returns, single-return, intermediate-returns, all-returns
+
+   OpenGL 1.x
+   Laura Toma
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include <math.h>
+#include <assert.h>
+#include <iostream>
+#include <queue>
+#include <unordered_map>
+#include <algorithm>
+
+//parallel loops use OpenMP; without it the code runs on one thread
+#ifdef _OPENMP
+#include <omp.h>
+#else
+inline int omp_get_thread_num() { return 0; }
+inline int omp_get_num_threads() { return 1; }
+inline int omp_get_max_threads() { return 1; }
+inline double omp_get_wtime() { return clock()/(double)CLOCKS_PER_SEC; }
+#endif
+
+//this allows this code to compile both on apple and linux platforms
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+#include <OpenGL/glext.h>
+#else
+//vertex buffer objects are OpenGL 1.5, and framebuffer objects
+//EXT_framebuffer_object, declared in glext.h on linux
+#define GL_GLEXT_PROTOTYPES
+#include <GL/glut.h>
+#endif
+#include <vector>
+#include <math.h>
+
+using namespace std;
+
+typedef struct _lidarPoint {
+  float x,y,z;
+  int nb_of_returns; //how many returns this pulse has
+  int return_number; //the number of this return
+  int code;  //classification code read from file
+
+  int mycode; //classification code assigned by us
+} lidarPoint;
+
+class Point{
+public:
+  float x, y, z;
+  Point(float i, float j, float k): x(i), y(j), z(k) {}
+};
+
+//the array of lidar points; note: this needs to be global because it
+//needs to be rendered
+vector<lidarPoint>  points;
+
+//bounding box of the points, updated when the terrain is loaded from file
+float minx, maxx, miny, maxy, minz, maxz;
+const int NODATA = -9999;
+const int WINDOWSIZE = 500;
+const int BIGINT = 0x0fffffff;
+
+//for hill shade
+vector<vector<float> > elevation;
+float min_elevation; //This is used instead of the minz value since
+		     //minz is affected by weird LIDAR noise.
+
+//the sun of the hill shade, see SUN. Set with -sun and -multisun, and
+//with keys a/A, e/E and n
+#define MAX_SUN_DIRECTIONS 8
+float sun_azimuth = 225;    //degrees clockwise from north (+y)
+float sun_altitude = 35.26; //degrees above the horizon
+int SUN_DIRECTIONS = 1;     //number of suns blended
+
+//cast shadows on the grid hill shade, see CAST SHADOWS. Set with
+//-shadows and key 'S'
+#define ALL_SUNS_LIT 0xff
+int CAST_SHADOWS = 0;
+float SHADOW_LIGHT = 0.35; //fraction of the direct light left in shadow
+vector<unsigned char> cell_lit; //bit k of cell c = i*cols+j is set if
+				//sun k reaches the cell
+
+//sky view factor of elevation, see SKY VIEW. Computed from
+//SKY_DIRECTIONS horizons if > 0; set with -skyview
+int SKY_DIRECTIONS = 0;
+vector<vector<float> > sky_view; //in [0,1], 1 for an open plain
+
+//observers of the viewshed, see VIEWSHED. Added with -viewshed and
+//-observers
+typedef struct _observer {
+  float x, y;   //map coordinates
+  float height; //eye above the elevation grid
+} observer;
+vector<observer> observers;
+vector<vector<float> > viewshed; //number of observers that see each cell
+int DRAW_VIEWSHED = 0; //overlay viewshed on the hill shade; key 'j'
+
+//drainage of the bare earth, see HYDROLOGY. Computed if FLOW, set
+//with -flow
+int FLOW = 0;
+vector<vector<float> > filled_dem; //the ground, depressions filled
+vector<vector<float> > flow_dir;   //D8 direction, ESRI codes (1=E,
+				   //2=SE, 4=S, ... 128=NE); 0 if the
+				   //cell drains off the grid
+vector<vector<float> > flow_acc;   //number of cells draining through
+				   //each cell, itself included
+
+//contour lines of elevation, see CONTOURS. Computed at every multiple
+//of the contour_intervals, if any; set with -contours
+vector<float> contour_intervals;
+typedef struct _contourLine {
+  float level;
+  int major;   //1 if level is a multiple of the largest interval
+  int closed;  //1 if the line is a loop
+  vector<float> pts; //point k at (row, col) = (pts[2k], pts[2k+1]), in
+		     //grid coordinates like the cells
+  long long key0, key1; //the grid edges crossed by the two ends
+} contourLine;
+vector<contourLine> contours;
+int DRAW_CONTOURS = 0; //overlay the contours on the grid views; key 'C'
+
+//the shading of the grid hill shade; key 'k' cycles through them
+#define SHADE_SUN 0     //the sun(s)
+#define SHADE_SKY 1     //the sky view factor, like ambient occlusion
+#define SHADE_SUN_SKY 2 //the sun(s), darkened by the sky view factor
+int SHADE_MODE = SHADE_SUN;
+
+//if not NULL, the rasters are written to files starting with
+//EXPORT_PREFIX and the program exits; set with -export. See EXPORT
+char* EXPORT_PREFIX = NULL;
+
+//derivatives of elevation, see SLOPE AND ASPECT. NODATA where
+//elevation is NODATA
+vector<vector<float> > slope_deg; //slope in degrees, [0,90)
+vector<vector<float> > slope_pct; //slope in percent, 100*rise/run
+vector<vector<float> > aspect;    //downslope direction in degrees
+				  //clockwise from north (+y); -1 if flat
+vector<float> cell_normal; //upward unit normal of cell c = i*cols+j at
+			   //3c: east, north, up. Up in NODATA cells
+
+//for ground find
+vector<vector<float> > last_grid;
+vector<vector<float> > min_last_grid; //lowest last return of each cell,
+				      //for the morphological and cloth
+				      //filters
+vector<vector<int> > is_ground;
+vector<vector<int> > find_ground();
+float building_slope_threshold = 0.5;
+
+//the ground classifier, set with -ground: GROUND_BFS is find_ground(),
+//GROUND_PMF the progressive morphological filter, GROUND_CSF the
+//cloth simulation filter; key 'm' cycles
+#define GROUND_BFS 0
+#define GROUND_PMF 1
+#define GROUND_CSF 2
+#define NB_GROUND_ENGINES 3
+int GROUND_ENGINE = GROUND_BFS;
+float PMF_MAX_WINDOW = 40; //largest opening window, in m
+float PMF_SLOPE = 0.3;     //of the terrain, dz/dx
+float PMF_DH0 = 0.3;       //height threshold of the smallest window, in m
+float PMF_DHMAX = 2.5;     //cap of the height threshold, in m
+float CSF_RESOLUTION = 2;  //spacing of the cloth particles, in m
+int CSF_RIGIDNESS = 3;     //spring passes per step; 1 for steep terrain
+float CSF_THRESHOLD = 0.5; //of a ground cell above the cloth, in m
+
+
+int point_density = 5; //average points per grid cell
+float cell_size; //side of a grid cell, set by gridify()
+int grid_rows, grid_cols; //size of the grid, set by gridify()
+
+//the points of each grid cell, as built by bin_points(): the points
+//of cell c = r*grid_cols + col are points[cell_points[k]] for k in
+//[cell_start[c], cell_start[c+1])
+vector<int> cell_start;
+vector<int> cell_points;
+
+//if > 0, gridify() fills NODATA cells within FILL_RADIUS cells of
+//valid data; set with -fill
+float FILL_RADIUS = 0;
+
+//if not TIN_NONE, gridify() triangulates the ground and rasterizes
+//the TIN into elevation; set with -tin. See DELAUNAY TIN
+#define TIN_NONE 0
+#define TIN_CODE 1  //the points with classification code 2
+#define TIN_CELLS 2 //the centres of the cells find_ground() calls ground
+int TIN_SOURCE = TIN_NONE;
+vector<float> tin_xyz;    //vertices of the TIN, x,y,z of vertex v at 3v
+vector<int> tin_triangles; //vertices of triangle t at 3t, 3t+1, 3t+2
+int DRAW_TIN = 0; //render the TIN instead of the grid views; key 'i'
+
+//if 1, the points are sorted along a Morton curve after loading;
+//set with -morton
+int MORTON_SORT = 0;
+
+
+/* ************************************************************ */
+/* PER CELL STATISTICS */
+/* A cellStat describes one raster computed from the points of each
+   grid cell: a statistic over the z values of the points that pass a
+   return filter. All cellStats are computed in one sweep over the
+   cells by compute_cell_stats(); gridify() uses it for elevation,
+   last_grid and min_last_grid, and the user can ask for more with -stat.
+
+   The order statistics (median, percentiles) use selection
+   (nth_element), not a full sort of the cell.
+*/
+#define STAT_MIN 0
+#define STAT_MAX 1
+#define STAT_COUNT 2
+#define STAT_MEAN 3
+#define STAT_STDDEV 4
+#define STAT_MEDIAN 5
+#define STAT_PERCENTILE 6
+
+typedef struct _cellStat {
+  const char* name;  //e.g. "p95:first", for printing
+  int stat;          //one of STAT_*
+  float percentile;  //for STAT_PERCENTILE, in [0,100]
+  int which_return;  //one of the WHICH_RETURN options
+  vector<vector<float> > grid; //the raster; NODATA in empty cells,
+			       //except for STAT_COUNT
+} cellStat;
+
+//the statistics requested with -stat
+vector<cellStat> user_stats;
+
+//canopy height model, see CANOPY HEIGHT. Computed if CHM, set with
+//-chm
+int CHM = 0;
+float CHM_PIT_DEPTH = 1; //a cell this much below the median of its
+			 //neighbours is a pit
+vector<vector<float> > chm; //highest first return above the ground
+vector<vector<float> > canopy_cover; //part of the first returns that
+				     //come from pulses with several returns
+
+//the buildings, connected components of the cells find_ground() calls
+//building; see BUILDINGS. Computed if BUILDINGS, set with -buildings
+int BUILDINGS = 0;
+float BUILDING_MIN_AREA = 10;  //smaller components are dropped, in m^2
+float FOOTPRINT_TOLERANCE = 1; //of the footprint simplification, in cells
+typedef struct _building {
+  int cells;          //number of cells
+  float area;         //in m^2
+  float max_height;   //above the ground
+  float mean_height;  //above the ground
+  float roof_slope;   //mean slope of the roof, in degrees; from
+		      //last_grid, or the roof planes with -roofs
+  float roof_z;       //mean elevation of the roof
+  vector<float> footprint; //outer boundary, simplified: corner k at
+			   //(x,y) = (footprint[2k], footprint[2k+1])
+} building;
+vector<building> buildings;
+vector<vector<int> > building_id; //1 + index into buildings, 0 if none
+int DRAW_FOOTPRINTS = 0; //overlay the footprints; key 'B'
+
+//the roof planes of the buildings, see ROOF PLANES. Computed if
+//ROOF_PLANES, set with -roofs
+int ROOF_PLANES = 0;
+float ROOF_PLANE_DIST = 0.15; //of an inlier to its plane, in m
+int ROOF_MIN_POINTS = 30;     //smaller planes are not kept
+typedef struct _roofPlane {
+  int building;      //index into buildings
+  float nx, ny, nz;  //unit normal, facing up
+  float cx, cy, cz;  //centroid of the inliers
+  float slope;       //in degrees
+  float aspect;      //downslope direction, degrees clockwise from north
+  float rmse;        //of the inliers to the plane
+  vector<int> inliers; //indices into points
+} roofPlane;
+vector<roofPlane> roof_planes;
+
+//if 1, last_grid, and so find_ground, is the lowest last return of
+//each cell instead of the average of the last returns; set with
+//-lowest_ground
+int LOWEST_GROUND = 0;
+
+//outlier removal before gridding: if SOR_K > 0, points whose mean
+//distance to their SOR_K nearest neighbours is more than SOR_NSIGMA
+//standard deviations above the mean are dropped; set with -sor. If
+//DROP_NOISE, points classified as noise (7, 18) are dropped; set with
+//-drop_noise
+int SOR_K = 0;
+float SOR_NSIGMA = 2;
+int DROP_NOISE = 0;
+
+//radius outlier removal: if ROR_RADIUS > 0, points with fewer than
+//ROR_MIN neighbours within ROR_RADIUS are dropped; set with -ror
+float ROR_RADIUS = 0;
+int ROR_MIN = 0;
+
+//thinning at load time, set with -thin <mode> <value>; see THINNING
+#define THIN_NONE 0
+#define THIN_NTH 1     //every value-th point
+#define THIN_RANDOM 2  //value points, chosen uniformly at random
+#define THIN_VOXEL 3   //one point per voxel of side value
+#define THIN_LOWEST 4  //the lowest point per cell of side value
+#define THIN_HIGHEST 5 //the highest point per cell of side value
+int THIN_MODE = THIN_NONE;
+float THIN_VALUE = 0;
+
+//per point local geometry from the FEATURE_K nearest neighbours, or
+//from the neighbours within FEATURE_RADIUS if it is > 0; see POINT
+//FEATURES. Computed if either is > 0, set with -features
+int FEATURE_K = 0;
+float FEATURE_RADIUS = 0;
+vector<float> feat_normal;      //unit normal of point i at 3i, facing up
+vector<float> feat_linearity;   //(l1-l2)/l1
+vector<float> feat_planarity;   //(l2-l3)/l1
+vector<float> feat_scattering;  //l3/l1
+vector<float> feat_verticality; //1-|normal z|, 0 flat, 1 vertical
+
+//whenever the user rotates and translates the scene, we update these
+//global translation and rotation
+GLfloat pos[3] = {0,0,0};
+GLfloat theta[3] = {0,0,0};
+
+// draw polygons line or filled. This will be used when rendering the
+// surface.
+GLint fillmode = 0;
+
+
+/* ************************************************************ */
+/* RENDER ON DEMAND */
+/* display() is called by GLUT on every expose event, and used to
+   re-submit the entire mesh each time. Instead we keep track of what
+   changed since the last frame:
+
+   DIRTY_GEOMETRY: the mesh itself changed (other view, new grid)
+   DIRTY_COLOR:    the mesh is the same but its colors changed
+   DIRTY_CAMERA:   the projection, translation or rotation changed
+
+   The mesh of the current view is compiled into a display list, which
+   is rebuilt only on DIRTY_GEOMETRY or DIRTY_COLOR. A frame is
+   rendered into a texture attached to a framebuffer object, and the
+   texture drawn to the window; if nothing is dirty display() just
+   draws that texture again. The frame is not copied back from the
+   window, whose pixels are undefined where it is covered or off
+   screen. Both live on the GL server, so exposes and keypresses that
+   don't change the image cost next to nothing over a remote X
+   connection. Without EXT_framebuffer_object every expose replays the
+   display list instead.
+*/
+#define DIRTY_GEOMETRY 1
+#define DIRTY_COLOR 2
+#define DIRTY_CAMERA 4
+#define DIRTY_ALL (DIRTY_GEOMETRY | DIRTY_COLOR | DIRTY_CAMERA)
+int dirty = DIRTY_ALL;
+
+GLuint scene_list = 0; //display list with the mesh of the current view
+GLuint frame_fbo = 0;  //framebuffer object the frames are rendered into
+GLuint frame_tex = 0;  //its color buffer, holding the last rendered frame
+GLuint frame_depth = 0; //its depth buffer
+int frame_cache = -1;  //1 if frame_fbo works, 0 if not, -1 not checked yet
+int frame_cached = 0;  //1 if frame_tex holds the current frame
+int tex_w = 0, tex_h = 0; //size of frame_tex (powers of 2, GL 1.x)
+int window_w = WINDOWSIZE, window_h = WINDOWSIZE;
+
+
+/* ************************************************************ */
+/* FILTERING POINTS BY THEIR RETURN SITUATION */
+/* A LiDAR point has a return number and a number of returns (for its
+   pulse).  A pulse may get several returns over vegetation, lets say
+   3, and this will result in three points:
+
+   return number/number of returns
+   1/3 x y z
+   2/3 x y z
+   3/3 x y z
+   note the x,y,z may be different for different return numbers
+
+   For bare earth, you will only have one return:
+   1/1
+
+
+   If ALL_RETURN, all points  are included
+   IF FIRST_RETURN, only the first returns are included, ie points with return number=1
+
+   If LAST_RETURN, only the last returns are included, i.e points with
+   1/1 and points with 2/2 or 3/3 or 4/4
+
+   If SINGLE_RETURN_ONLY, only the points of pulses with one return (1/1)
+
+   If INTERMEDIATE_ONLY, only the returns between the first and the
+   last, e.g. 2/3
+*/
+#define ALL_RETURN 0
+#define FIRST_RETURN 1
+#define LAST_RETURN 2
+#define MORE_THAN_ONE_RETURN 3
+#define SINGLE_RETURN_ONLY 4
+#define INTERMEDIATE_ONLY 5
+#define NB_WHICH_RETURN_OPTIONS 6
+// WHICH_RETURN  cycles through all options via keypress 't'
+int WHICH_RETURN = ALL_RETURN;
+
+
+
+/* ************************************************************ */
+/* FILTERING POINTS BY THEIR classification code */
+/*
+lidar classification codes  [from ...somewhere on internet]
+
+0 never classified
+1 unassigned
+2 ground
+3 low vegetation
+4 medium vegetation
+5 high vegetation
+6 building
+7 low point (noise)
+8 model key-point (mass point)
+9 water
+10 railroad
+11 road
+12 overlap
+13 wire-guard (shield)
+14 wire-conductor (phase)
+15 transmission tower
+17 bridge
+18 hight point (noise)
+19-255 reserved for asprs definition
+ */
+
+//These are used by render() to decide  what points to render.
+//By default draw everything; each one of these classes can be toggled
+//on/off in keypress()
+int GROUND=1;
+int VEG=1;
+int BUILDING=1;
+int OTHER=1;
+int HILL_SHADE = 1;
+
+
+/* **************************************** */
+/* chosing a color map:
+g
+   If COLORMAP == ONE_COLOR:  draw all filtered points in one color
+
+   If COLORMAP == CODE_COLOR: draw all filtered points with a color
+   based on their classification code p.code which was read from the
+   las file
+
+   If COLORMAP == MYCODE_COLOR:  draw all filtered points with a color
+   based on their classification code p.mycode which we computed
+
+   COLORMAP starts by default as ONE_COLOR and cycles through all
+   options via keypress 'c'.
+*/
+#define ONE_COLOR 0
+#define CODE_COLOR 1
+#define MYCODE_COLOR 2
+#define NB_COLORMAP_CHOICES 3
+int COLORMAP = ONE_COLOR;
+
+
+/* **************************************** */
+/* RENDERING THE POINTS
+   If DRAW_POINTS, the raw points are rendered instead of the grid
+   views; toggled via keypress 'p'.
+
+   The points are uploaded once into vertex buffers, sorted into
+   buckets by (return category, classification code). Every setting
+   of WHICH_RETURN and GROUND/VEG/BUILDING/OTHER selects a set of whole
+   buckets, so changing a filter only changes which contiguous ranges
+   of the buffers are drawn. Nothing is filtered on the CPU per frame.
+
+   The return categories are disjoint, and each WHICH_RETURN option is
+   a union of them:
+   SINGLE_RETURN:       1/1
+   FIRST_OF_MANY:       1/n with n>1
+   LAST_OF_MANY:        n/n with n>1
+   INTERMEDIATE_RETURN: r/n with 1<r<n
+*/
+#define SINGLE_RETURN 0
+#define FIRST_OF_MANY 1
+#define LAST_OF_MANY 2
+#define INTERMEDIATE_RETURN 3
+#define NB_RETURN_CATEGORIES 4
+#define NB_CODES 20 //codes 0..18 get their own bucket, 19 holds the rest
+#define NB_BUCKETS (NB_RETURN_CATEGORIES*NB_CODES)
+int DRAW_POINTS = 0;
+
+GLuint point_vbo = 0; //screen coordinates of the points, bucket order
+GLuint color_vbo = 0; //colors of the points, bucket order
+vector<int> bucket_start; //bucket b is [bucket_start[b], bucket_start[b+1])
+vector<int> bucket_order; //vertex k in the buffers is points[bucket_order[k]]
+
+
+
+//predefine some colors for convenience
+GLfloat red[3] = {1.0, 0.0, 0.0};
+GLfloat green[3] = {0.0, 1.0, 0.0};
+GLfloat blue[3] = {0.0, 0.0, 1.0};
+GLfloat black[3] = {0.0, 0.0, 0.0};
+GLfloat white[3] = {1.0, 1.0, 1.0};
+GLfloat gray[3] = {0.5, 0.5, 0.5};
+GLfloat yellow[3] = {1.0, 1.0, 0.0};
+GLfloat magenta[3] = {1.0, 0.0, 1.0};
+GLfloat cyan[3] = {0.0, 1.0, 1.0};
+
+/* from https://www.opengl.org/discussion_boards/showthread.php/132502-Color-tables  */
+GLfloat brown[3] = { 0.647059, 0.164706, 0.164706};
+GLfloat DarkBrown[3] = { 0.36, 0.25, 0.20};
+GLfloat DarkTan[3] = { 0.59, 0.41, 0.31};
+GLfloat Maroon[3]= { 0.556863, 0.137255, 0.419608};
+GLfloat DarkWood[3] = { 0.52, 0.37, 0.26};
+
+GLfloat  Copper[3] = { 0.72,  0.45,  0.20};
+
+GLfloat green1[3] = {.5, 1, 0.5};
+GLfloat green2[3] = {0.0, .8, 0.0};
+GLfloat green3[3] = {0.0, .5, 0.0};
+GLfloat ForestGreen[3] = { 0.137255, 0.556863, 0.137255};
+GLfloat MediumForestGreen[3] = { 0.419608 , 0.556863 , 0.137255};
+GLfloat LimeGreen[3] ={ 0.196078,  0.8 , 0.196078};
+
+GLfloat Orange[3] = { 1, .5, 0};
+GLfloat Silver[3] = { 0.90, 0.91, 0.98};
+GLfloat Wheat[3] = { 0.847059 , 0.847059, 0.74902};
+
+
+/* forward declarations of functions */
+void display(void);
+void keypress(unsigned char key, int x, int y);
+void reshape(int w, int h);
+void mark_dirty(int what);
+
+void draw_hill_shade();
+void draw_ground();
+void draw_tin();
+void draw_contours();
+void draw_footprints();
+void draw_points();
+void build_point_buffers();
+void upload_point_colors();
+void draw_xy_rect(GLfloat z, GLfloat* col);
+void draw_xz_rect(GLfloat y, GLfloat* col);
+void draw_yz_rect(GLfloat x, GLfloat* col);
+void cube(GLfloat side);
+void filledcube(GLfloat side);
+void draw_axes();
+
+//reads the points from file in global array points
+void readPointsFromFile(char* fname);
+
+int return_category(lidarPoint p);
+void eigen3_block(int n, const float* a, const float* b, const float* c,
+		  const float* d, const float* e, const float* f,
+		  float* e1, float* e2, float* e3,
+		  float* nx, float* ny, float* nz);
+int return_category_on(int category, int which);
+void radix_sort(vector<uint32_t>& keys, vector<int>& idx);
+
+//FUNCTIONS CREATED BY ETHAN AND JAKE
+
+//the grid cell of p, r*grid_cols + c. Points on the top and right
+//edges of the bounding box go into the last row and column.
+int point_cell(lidarPoint p) {
+  int r = floor((p.y - miny)/cell_size);
+  int c = floor((p.x - minx)/cell_size);
+  if (r >= grid_rows) r = grid_rows - 1;
+  if (c >= grid_cols) c = grid_cols - 1;
+  if (r < 0) r = 0;
+  if (c < 0) c = 0;
+  return r*grid_cols + c;
+}
+
+
+/* replace a[0..n) by its exclusive prefix sum, in parallel: each
+   thread sums its block, the block sums are scanned, then each thread
+   scans its block starting from its offset */
+void prefix_sum(int* a, int n) {
+  vector<int> block_sum(omp_get_max_threads()+1, 0);
+#pragma omp parallel
+  {
+    int nt = omp_get_num_threads();
+    int t = omp_get_thread_num();
+    int lo = (long)n*t/nt, hi = (long)n*(t+1)/nt;
+
+    int sum = 0;
+    for (int i = lo; i < hi; i++) sum += a[i];
+    block_sum[t+1] = sum;
+
+#pragma omp barrier
+#pragma omp single
+    for (int k = 0; k < nt; k++) block_sum[k+1] += block_sum[k];
+
+    sum = block_sum[t];
+    for (int i = lo; i < hi; i++) {
+      int tmp = a[i];
+      a[i] = sum;
+      sum += tmp;
+    }
+  }
+}
+
+
+/* Bin the points into the grid cells with a counting sort, so that
+   the points of every cell are contiguous in cell_points (see
+   cell_start). Three parallel passes, and no allocations besides the
+   two arrays:
+
+   1. count the points of each cell into cell_start[c+1]
+   2. exclusive prefix sum, so cell_start[c+1] is the start of cell c
+   3. scatter: each point goes to cell_start[c+1]++; when done,
+      cell_start[c+1] is the end of cell c, i.e. the start of c+1
+
+   The order of the points within a cell is not defined.
+*/
+void bin_points() {
+  int n = points.size();
+  int num_cells = grid_rows*grid_cols;
+
+  cell_start.assign(num_cells+1, 0);
+  cell_points.resize(n);
+
+  //pass 1: histogram
+#pragma omp parallel for
+  for (int i = 0; i < n; i++) {
+    int c = point_cell(points[i]);
+#pragma omp atomic
+    cell_start[c+1]++;
+  }
+
+  //pass 2: prefix sum
+  int* counts = &cell_start[1];
+  prefix_sum(counts, num_cells);
+
+  //pass 3: scatter
+#pragma omp parallel for
+  for (int i = 0; i < n; i++) {
+    int c = point_cell(points[i]);
+    int k;
+#pragma omp atomic capture
+    k = counts[c]++;
+    cell_points[k] = i;
+  }
+}
+
+
+/* parse a statistic given as <stat>[:<return>], where <stat> is one
+   of min, max, count, mean, stddev, median or pNN for the NN-th
+   percentile (e.g. p95, p2.5), and <return> is one of all, first,
+   last, many (more than one return), single (the only return) or
+   intermediate; the default is all. Returns 0 if spec can't be
+   parsed. */
+int parse_cell_stat(const char* spec, cellStat* cs) {
+  char stat[32] = "", ret[32] = "all";
+  if (sscanf(spec, "%31[^:]:%31s", stat, ret) < 1) return 0;
+
+  cs->name = spec;
+  cs->percentile = 0;
+  if (strcmp(stat, "min") == 0) cs->stat = STAT_MIN;
+  else if (strcmp(stat, "max") == 0) cs->stat = STAT_MAX;
+  else if (strcmp(stat, "count") == 0) cs->stat = STAT_COUNT;
+  else if (strcmp(stat, "mean") == 0) cs->stat = STAT_MEAN;
+  else if (strcmp(stat, "stddev") == 0) cs->stat = STAT_STDDEV;
+  else if (strcmp(stat, "median") == 0) cs->stat = STAT_MEDIAN;
+  else if (stat[0] == 'p' && sscanf(stat+1, "%f", &cs->percentile) == 1 &&
+	   cs->percentile >= 0 && cs->percentile <= 100) {
+    cs->stat = STAT_PERCENTILE;
+  }
+  else return 0;
+
+  if (strcmp(ret, "all") == 0) cs->which_return = ALL_RETURN;
+  else if (strcmp(ret, "first") == 0) cs->which_return = FIRST_RETURN;
+  else if (strcmp(ret, "last") == 0) cs->which_return = LAST_RETURN;
+  else if (strcmp(ret, "many") == 0) cs->which_return = MORE_THAN_ONE_RETURN;
+  else if (strcmp(ret, "single") == 0) cs->which_return = SINGLE_RETURN_ONLY;
+  else if (strcmp(ret, "intermediate") == 0) cs->which_return = INTERMEDIATE_ONLY;
+  else return 0;
+
+  return 1;
+}
+
+cellStat make_cell_stat(const char* name, int stat, int which_return) {
+  cellStat cs;
+  cs.name = name;
+  cs.stat = stat;
+  cs.percentile = 0;
+  cs.which_return = which_return;
+  return cs;
+}
+
+
+//the p-th percentile of z[0..n), interpolating between the two
+//closest ranks. Reorders z.
+float percentile(float* z, int n, float p) {
+  float rank = p/100*(n-1);
+  int lo = floor(rank);
+  if (lo >= n-1) lo = n-1;
+  nth_element(z, z+lo, z+n);
+  float v = z[lo];
+  if (lo+1 < n && rank > lo) {
+    //z[lo+1..n) are all >= z[lo]; the next rank is their minimum
+    float next = *min_element(z+lo+1, z+n);
+    v += (rank - lo)*(next - v);
+  }
+  return v;
+}
+
+
+//statistic cs over z[0..n); n > 0. Reorders z.
+float reduce_cell(const cellStat& cs, float* z, int n) {
+  switch (cs.stat) {
+  case STAT_MIN:
+    return *min_element(z, z+n);
+  case STAT_MAX:
+    return *max_element(z, z+n);
+  case STAT_COUNT:
+    return n;
+  case STAT_MEAN:
+  case STAT_STDDEV: {
+    float sum = 0;
+    for (int i = 0; i < n; i++) sum += z[i];
+    float mean = sum/n;
+    if (cs.stat == STAT_MEAN) return mean;
+    float var = 0;
+    for (int i = 0; i < n; i++) var += (z[i]-mean)*(z[i]-mean);
+    return sqrt(var/n);
+  }
+  case STAT_MEDIAN:
+    return percentile(z, n, 50);
+  case STAT_PERCENTILE:
+    return percentile(z, n, cs.percentile);
+  default:
+    printf("unknown cell statistic. oops.\n");
+    exit(1);
+  }
+}
+
+
+/* compute all the cellStats in stats in one parallel sweep over the
+   cells, using the points binned by bin_points(). The z values of a
+   cell are gathered once per return filter into a per thread buffer,
+   which every statistic on that filter then reduces. Which of the
+   filters in use take each return category is worked out once, so a
+   point costs one lookup and one push per filter it goes to. If cover is not
+   NULL, it gets the canopy cover of each cell (see CANOPY HEIGHT) from
+   the same sweep. */
+void compute_cell_stats(vector<cellStat>& stats,
+			vector<vector<float> >* cover = NULL) {
+  //which return filters are used at all, and which of them take the
+  //points of each return category
+  int used[NB_WHICH_RETURN_OPTIONS] = {0};
+  for (unsigned int s = 0; s < stats.size(); s++) {
+    used[stats[s].which_return] = 1;
+    stats[s].grid.assign(grid_rows, vector<float>(grid_cols, NODATA));
+  }
+  int filters[NB_RETURN_CATEGORIES][NB_WHICH_RETURN_OPTIONS];
+  int nb_filters[NB_RETURN_CATEGORIES] = {0};
+  for (int category = 0; category < NB_RETURN_CATEGORIES; category++) {
+    for (int w = 0; w < NB_WHICH_RETURN_OPTIONS; w++) {
+      if (used[w] && return_category_on(category, w)) {
+	filters[category][nb_filters[category]++] = w;
+      }
+    }
+  }
+  if (cover) cover->assign(grid_rows, vector<float>(grid_cols, NODATA));
+
+#pragma omp parallel
+  {
+    vector<float> z[NB_WHICH_RETURN_OPTIONS];
+
+#pragma omp for schedule(dynamic, 16)
+    for (int i = 0; i < grid_rows; i++) {
+      for (int j = 0; j < grid_cols; j++) {
+	int c = i*grid_cols + j;
+
+	for (int w = 0; w < NB_WHICH_RETURN_OPTIONS; w++) z[w].clear();
+	int first = 0, first_of_many = 0;
+	for (int m = cell_start[c]; m < cell_start[c+1]; m++) {
+	  lidarPoint& p = points[cell_points[m]];
+	  int category = return_category(p);
+	  for (int k = 0; k < nb_filters[category]; k++) {
+	    z[filters[category][k]].push_back(p.z);
+	  }
+	  if (category == SINGLE_RETURN) first++;
+	  if (category == FIRST_OF_MANY) first++, first_of_many++;
+	}
+	if (cover) {
+	  (*cover)[i][j] = first ? float(first_of_many)/first : NODATA;
+	}
+
+	for (unsigned int s = 0; s < stats.size(); s++) {
+	  vector<float>& zs = z[stats[s].which_return];
+	  if (zs.size() > 0) {
+	    stats[s].grid[i][j] = reduce_cell(stats[s], &zs[0], zs.size());
+	  }
+	  else if (stats[s].stat == STAT_COUNT) {
+	    stats[s].grid[i][j] = 0;
+	  }
+	}
+      }
+    }
+  }
+}
+
+
+//print the range of a cellStat raster
+void print_cell_stat(const cellStat& cs) {
+  float lo = BIGINT, hi = -BIGINT;
+  int empty = 0;
+  for (int i = 0; i < grid_rows; i++) {
+    for (int j = 0; j < grid_cols; j++) {
+      float v = cs.grid[i][j];
+      if (v == NODATA) {
+	empty++;
+	continue;
+      }
+      if (v < lo) lo = v;
+      if (v > hi) hi = v;
+    }
+  }
+  printf("stat %s: [%f, %f], %d empty cells\n", cs.name, lo, hi, empty);
+}
+
+
+/* ************************************************************ */
+/* HOLE FILLING */
+/* Cells without points are NODATA; they show as magenta holes and cut
+   the BFS in find_ground. fill_nodata() interpolates them from the
+   valid cells around them, in O(cells):
+
+   - pull: a pyramid is built where each level averages 2x2 cells of
+     the level below, weighted by how much valid data they hold;
+   - push: going back down, every cell that is not fully covered by
+     data blends in the (bilinearly interpolated) coarser level.
+
+   A hole cell so gets a weighted average of the data around it, with
+   weights falling off with distance like inverse distance weighting,
+   without searching a window per cell. Only holes within radius cells
+   of valid data are filled; the distance is an exact Euclidean
+   distance transform (Felzenszwalb-Huttenlocher), done per column and
+   then per row. All passes are parallel over row (or column) bands.
+*/
+#define EDT_INF 1e20f
+
+/* 1D squared distance transform of f[0..n): d[i] = min_j (i-j)^2 +
+   f[j], as the lower envelope of parabolas. v and z are scratch space
+   of n and n+1 elements. */
+void edt_1d(const float* f, int n, float* d, int* v, float* z) {
+  int k = 0;
+  v[0] = 0;
+  z[0] = -EDT_INF;
+  z[1] = EDT_INF;
+  for (int q = 1; q < n; q++) {
+    //drop the parabolas that the one at q hides
+    float s = ((f[q] + q*q) - (f[v[k]] + v[k]*v[k])) / (2*q - 2*v[k]);
+    while (s <= z[k]) {
+      k--;
+      s = ((f[q] + q*q) - (f[v[k]] + v[k]*v[k])) / (2*q - 2*v[k]);
+    }
+    k++;
+    v[k] = q;
+    z[k] = s;
+    z[k+1] = EDT_INF;
+  }
+  k = 0;
+  for (int q = 0; q < n; q++) {
+    while (z[k+1] < q) k++;
+    d[q] = (q - v[k])*(q - v[k]) + f[v[k]];
+  }
+}
+
+
+//squared distance, in cells, from every cell to the nearest cell of
+//grid that is not NODATA; flat, row major
+void distance_to_data(const vector<vector<float> >& grid, vector<float>& dist2) {
+  int rows = grid.size(), cols = grid[0].size();
+  dist2.resize(rows*cols);
+
+#pragma omp parallel
+  {
+    int n = max(rows, cols);
+    vector<float> f(n), d(n), z(n+1);
+    vector<int> v(n);
+
+#pragma omp for
+    for (int j = 0; j < cols; j++) {
+      for (int i = 0; i < rows; i++) f[i] = (grid[i][j] == NODATA) ? EDT_INF : 0;
+      edt_1d(&f[0], rows, &d[0], &v[0], &z[0]);
+      for (int i = 0; i < rows; i++) dist2[i*cols + j] = d[i];
+    }
+
+#pragma omp for
+    for (int i = 0; i < rows; i++) {
+      for (int j = 0; j < cols; j++) f[j] = dist2[i*cols + j];
+      edt_1d(&f[0], cols, &d[0], &v[0], &z[0]);
+      for (int j = 0; j < cols; j++) dist2[i*cols + j] = d[j];
+    }
+  }
+}
+
+
+//one level of the pull-push pyramid: value and weight (coverage by
+//valid data, in [0,1]) of every cell, row major
+typedef struct _pyramidLevel {
+  int rows, cols;
+  vector<float> v, w;
+} pyramidLevel;
+
+
+//fill the NODATA cells of grid that are within radius cells of valid
+//data; see HOLE FILLING. Returns the number of cells filled.
+int fill_nodata(vector<vector<float> >& grid, float radius) {
+  int rows = grid.size(), cols = grid[0].size();
+
+  vector<pyramidLevel> pyr(1);
+  pyr[0].rows = rows;
+  pyr[0].cols = cols;
+  pyr[0].v.resize(rows*cols);
+  pyr[0].w.resize(rows*cols);
+#pragma omp parallel for
+  for (int i = 0; i < rows; i++) {
+    for (int j = 0; j < cols; j++) {
+      int valid = (grid[i][j] != NODATA);
+      pyr[0].v[i*cols + j] = valid ? grid[i][j] : 0;
+      pyr[0].w[i*cols + j] = valid;
+    }
+  }
+
+  //pull: average 2x2 blocks, weighted by coverage
+  while (pyr.back().rows > 1 || pyr.back().cols > 1) {
+    pyramidLevel& fine = pyr.back();
+    pyramidLevel coarse;
+    coarse.rows = (fine.rows + 1)/2;
+    coarse.cols = (fine.cols + 1)/2;
+    coarse.v.assign(coarse.rows*coarse.cols, 0);
+    coarse.w.assign(coarse.rows*coarse.cols, 0);
+
+#pragma omp parallel for
+    for (int i = 0; i < coarse.rows; i++) {
+      for (int j = 0; j < coarse.cols; j++) {
+	float sw = 0, swv = 0;
+	for (int di = 0; di < 2; di++) {
+	  for (int dj = 0; dj < 2; dj++) {
+	    int fi = 2*i + di, fj = 2*j + dj;
+	    if (fi >= fine.rows || fj >= fine.cols) continue;
+	    sw += fine.w[fi*fine.cols + fj];
+	    swv += fine.w[fi*fine.cols + fj] * fine.v[fi*fine.cols + fj];
+	  }
+	}
+	coarse.v[i*coarse.cols + j] = (sw > 0) ? swv/sw : 0;
+	coarse.w[i*coarse.cols + j] = fmin(sw, 1);
+      }
+    }
+    pyr.push_back(coarse);
+  }
+
+  //push: fill what each level doesn't cover from the level above it
+  for (int l = pyr.size() - 2; l >= 0; l--) {
+    pyramidLevel& fine = pyr[l];
+    pyramidLevel& coarse = pyr[l+1];
+
+#pragma omp parallel for
+    for (int i = 0; i < fine.rows; i++) {
+      for (int j = 0; j < fine.cols; j++) {
+	float w = fine.w[i*fine.cols + j];
+	if (w >= 1) continue;
+
+	//bilinear interpolation in the coarse level
+	float ci = fmin(fmax((i + 0.5f)/2 - 0.5f, 0), coarse.rows - 1);
+	float cj = fmin(fmax((j + 0.5f)/2 - 0.5f, 0), coarse.cols - 1);
+	int i0 = floor(ci), j0 = floor(cj);
+	int i1 = min(i0 + 1, coarse.rows - 1), j1 = min(j0 + 1, coarse.cols - 1);
+	float ti = ci - i0, tj = cj - j0;
+	float up = (1-ti)*((1-tj)*coarse.v[i0*coarse.cols + j0] +
+			   tj*coarse.v[i0*coarse.cols + j1]) +
+	  ti*((1-tj)*coarse.v[i1*coarse.cols + j0] +
+	      tj*coarse.v[i1*coarse.cols + j1]);
+
+	fine.v[i*fine.cols + j] = w*fine.v[i*fine.cols + j] + (1-w)*up;
+      }
+    }
+  }
+
+  //only the holes close enough to data get a value
+  vector<float> dist2;
+  distance_to_data(grid, dist2);
+  float r2 = radius*radius;
+  int filled = 0;
+#pragma omp parallel for reduction(+:filled)
+  for (int i = 0; i < rows; i++) {
+    for (int j = 0; j < cols; j++) {
+      if (grid[i][j] == NODATA && dist2[i*cols + j] <= r2) {
+	grid[i][j] = pyr[0].v[i*cols + j];
+	filled++;
+      }
+    }
+  }
+  return filled;
+}
+
+
+/* ************************************************************ */
+/* PROGRESSIVE MORPHOLOGICAL FILTER */
+/* Ground classification by Zhang et al. (2003): the min-z grid is
+   opened (eroded, then dilated) with square windows of growing size
+   w = 3, 5, 9, 17, ... cells. An opening removes the objects smaller
+   than its window, so a cell that the opening lowers by more than
+
+     dh = PMF_SLOPE * (w - w_prev) * cell_size + PMF_DH0, at most PMF_DHMAX
+
+   is not ground. Each opening then becomes the surface for the next,
+   larger, window, up to PMF_MAX_WINDOW (the largest building).
+
+   Erosion and dilation are running min and max, separable into rows
+   and columns. With the van Herk/Gil-Werman algorithm a line is split
+   into blocks of w values; a window covers the end of one block and
+   the start of the next, so its min is that of a suffix min and a
+   prefix min, and costs 3 comparisons per cell whatever w is. Dilation
+   is the erosion of -z.
+
+   NODATA cells are interpolated first, so holes don't cut the windows,
+   and stay unclassified (-1) as in find_ground().
+*/
+
+//min over the windows [x - r, x + r] of the n values line[0],
+//line[stride], ..., in place; outside the line counts as +infinity
+void vhgw_min(float* line, int n, int stride, int r,
+	      vector<float>& buf, vector<float>& g, vector<float>& h) {
+  int w = 2*r + 1;
+  int m = (n + 2*r + w - 1) / w * w;
+  buf.assign(m, BIGINT);
+  g.resize(m);
+  h.resize(m);
+  for (int k = 0; k < n; k++) buf[k + r] = line[k*stride];
+
+  for (int k = 0; k < m; k++) {
+    g[k] = (k % w == 0) ? buf[k] : min(g[k-1], buf[k]);
+  }
+  for (int k = m - 1; k >= 0; k--) {
+    h[k] = (k % w == w - 1) ? buf[k] : min(h[k+1], buf[k]);
+  }
+  for (int k = 0; k < n; k++) line[k*stride] = min(h[k], g[k + 2*r]);
+}
+
+
+//min of grid (sign 1) or max (sign -1) over the (2r+1)^2 window of
+//each cell; grid is rows x cols, row major
+void erode_grid(vector<float>& grid, int rows, int cols, int r, float sign) {
+  if (sign < 0) {
+    for (unsigned int c = 0; c < grid.size(); c++) grid[c] = -grid[c];
+  }
+#pragma omp parallel
+  {
+    vector<float> buf, g, h;
+#pragma omp for
+    for (int i = 0; i < rows; i++) vhgw_min(&grid[i*cols], cols, 1, r, buf, g, h);
+#pragma omp for
+    for (int j = 0; j < cols; j++) vhgw_min(&grid[j], rows, cols, r, buf, g, h);
+  }
+  if (sign < 0) {
+    for (unsigned int c = 0; c < grid.size(); c++) grid[c] = -grid[c];
+  }
+}
+
+
+//classify the cells of min_last_grid as is_ground does: 1 ground, 0
+//not, -1 NODATA
+vector<vector<int> > pmf_ground() {
+  int rows = min_last_grid.size();
+  int cols = min_last_grid[0].size();
+  double start = omp_get_wtime();
+
+  vector<vector<float> > z = min_last_grid;
+  fill_nodata(z, rows + cols);
+  vector<float> surface(rows*cols);
+  for (int i = 0; i < rows; i++) {
+    for (int j = 0; j < cols; j++) surface[i*cols + j] = z[i][j];
+  }
+
+  vector<vector<int> > ground(rows, vector<int>(cols, 1));
+  vector<float> opened;
+  int prev_w = 1;
+  int windows = 0;
+  for (int r = 1; (2*r + 1)*cell_size <= PMF_MAX_WINDOW || r == 1; r *= 2) {
+    int w = 2*r + 1;
+    opened = surface;
+    erode_grid(opened, rows, cols, r, 1);
+    erode_grid(opened, rows, cols, r, -1);
+
+    float dh = (prev_w == 1) ? PMF_DH0 :
+      PMF_SLOPE*(w - prev_w)*cell_size + PMF_DH0;
+    dh = min(dh, PMF_DHMAX);
+    for (int i = 0; i < rows; i++) {
+      for (int j = 0; j < cols; j++) {
+	if (surface[i*cols + j] - opened[i*cols + j] > dh) ground[i][j] = 0;
+      }
+    }
+    surface.swap(opened);
+    prev_w = w;
+    windows++;
+  }
+
+  int n_ground = 0, n_other = 0;
+  for (int i = 0; i < rows; i++) {
+    for (int j = 0; j < cols; j++) {
+      if (min_last_grid[i][j] == NODATA) ground[i][j] = -1;
+      else if (ground[i][j] == 1) n_ground++;
+      else n_other++;
+    }
+  }
+  printf("morphological filter: %d windows up to %d cells, %d ground and %d other cells, in %.2fs\n",
+	 windows, prev_w, n_ground, n_other, omp_get_wtime() - start);
+  return ground;
+}
+
+
+
+/* ************************************************************ */
+/* CLOTH SIMULATION FILTER */
+/* Ground classification by Zhang et al. (2016): the terrain is turned
+   upside down and a cloth dropped on it. The cloth is a grid of
+   particles CSF_RESOLUTION apart that move only vertically: gravity
+   pulls them down (Verlet integration with damping), a particle that
+   reaches the inverted surface sticks to it, and springs between
+   neighbours keep the cloth from falling into the pits, which are the
+   buildings and trees the right way up. Cells within CSF_THRESHOLD of
+   the cloth are ground.
+
+   The particles step together (Jacobi): each step and each spring
+   pass writes a new copy of the cloth from the old one, in parallel
+   over the rows, with a branch-free inner loop over the columns. The
+   simulation stops when no particle moves more than CSF_EPSILON, or
+   after CSF_MAX_ITERATIONS steps.
+*/
+#define CSF_TIME_STEP 0.65
+#define CSF_GRAVITY 0.2
+#define CSF_DAMPING 0.01
+#define CSF_EPSILON 0.005
+#define CSF_MAX_ITERATIONS 500
+
+//one spring pass: every movable particle moves toward its 4
+//neighbours, all the way toward the fixed ones and half way toward
+//the movable ones, averaged. Outside the cloth counts as itself
+void csf_springs(const vector<float>& z, vector<float>& out,
+		 const vector<float>& movable, int rows, int cols) {
+#pragma omp parallel for
+  for (int i = 0; i < rows; i++) {
+    int up = (i > 0) ? -cols : 0;
+    int down = (i < rows - 1) ? cols : 0;
+#pragma omp simd
+    for (int j = 0; j < cols; j++) {
+      int c = i*cols + j;
+      int left = (j > 0) ? -1 : 0;
+      int right = (j < cols - 1) ? 1 : 0;
+      float d = (1 - 0.5f*movable[c + up])*(z[c + up] - z[c])
+	+ (1 - 0.5f*movable[c + down])*(z[c + down] - z[c])
+	+ (1 - 0.5f*movable[c + left])*(z[c + left] - z[c])
+	+ (1 - 0.5f*movable[c + right])*(z[c + right] - z[c]);
+      out[c] = z[c] + movable[c]*0.25f*d;
+    }
+  }
+}
+
+
+//classify the cells of min_last_grid as is_ground does: 1 ground, 0
+//not, -1 NODATA
+vector<vector<int> > csf_ground() {
+  int rows = min_last_grid.size();
+  int cols = min_last_grid[0].size();
+  double start = omp_get_wtime();
+
+  vector<vector<float> > z = min_last_grid;
+  fill_nodata(z, rows + cols);
+
+  //the cloth; a particle rests on the cell at its centre, inverted
+  int f = max(1, (int)(CSF_RESOLUTION/cell_size + 0.5));
+  int crows = (rows + f - 1)/f;
+  int ccols = (cols + f - 1)/f;
+  int n = crows*ccols;
+  vector<float> surface(n, -BIGINT);
+  float top = -BIGINT;
+  for (int i = 0; i < crows; i++) {
+    for (int j = 0; j < ccols; j++) {
+      float h = z[min(i*f + f/2, rows - 1)][min(j*f + f/2, cols - 1)];
+      if (h == NODATA) continue;
+      surface[i*ccols + j] = -h;
+      top = max(top, -h);
+    }
+  }
+  vector<float> cloth(n, top + 1), prev(n, top + 1), next(n);
+  vector<float> movable(n, 1);
+
+  const float fall = CSF_GRAVITY*CSF_TIME_STEP*CSF_TIME_STEP;
+  int iterations = 0;
+  float moved = 0;
+  for (iterations = 1; iterations <= CSF_MAX_ITERATIONS; iterations++) {
+    //gravity, then the collisions with the surface
+#pragma omp parallel for
+    for (int i = 0; i < crows; i++) {
+#pragma omp simd
+      for (int c = i*ccols; c < (i + 1)*ccols; c++) {
+	float zn = cloth[c] + movable[c]*((cloth[c] - prev[c])*(1 - CSF_DAMPING) - fall);
+	float hit = (zn <= surface[c]) ? 1.0f : 0.0f;
+	next[c] = hit*surface[c] + (1 - hit)*zn;
+	movable[c] *= 1 - hit;
+      }
+    }
+    prev.swap(cloth);
+    cloth.swap(next);
+
+    for (int k = 0; k < CSF_RIGIDNESS; k++) {
+      csf_springs(cloth, next, movable, crows, ccols);
+      cloth.swap(next);
+    }
+
+    moved = 0;
+#pragma omp parallel for reduction(max:moved)
+    for (int c = 0; c < n; c++) {
+      moved = max(moved, movable[c]*fabsf(cloth[c] - prev[c]));
+    }
+    if (moved < CSF_EPSILON) break;
+  }
+
+  //the cloth, right side up, interpolated bilinearly at the cells
+  vector<vector<int> > ground(rows, vector<int>(cols, -1));
+  int n_ground = 0, n_other = 0;
+  for (int i = 0; i < rows; i++) {
+    float u = float(i - f/2)/f;
+    int i0 = min(max((int)floor(u), 0), crows - 1);
+    int i1 = min(i0 + 1, crows - 1);
+    float fu = min(max(u - i0, 0.0f), 1.0f);
+    for (int j = 0; j < cols; j++) {
+      if (min_last_grid[i][j] == NODATA) continue;
+      float v = float(j - f/2)/f;
+      int j0 = min(max((int)floor(v), 0), ccols - 1);
+      int j1 = min(j0 + 1, ccols - 1);
+      float fv = min(max(v - j0, 0.0f), 1.0f);
+      float h = -((1 - fu)*((1 - fv)*cloth[i0*ccols + j0] + fv*cloth[i0*ccols + j1])
+		  + fu*((1 - fv)*cloth[i1*ccols + j0] + fv*cloth[i1*ccols + j1]));
+      if (min_last_grid[i][j] - h < CSF_THRESHOLD) {
+	ground[i][j] = 1;
+	n_ground++;
+      } else {
+	ground[i][j] = 0;
+	n_other++;
+      }
+    }
+  }
+  printf("cloth filter: %dx%d particles, %d steps, %d ground and %d other cells, in %.2fs\n",
+	 crows, ccols, min(iterations, CSF_MAX_ITERATIONS), n_ground, n_other,
+	 omp_get_wtime() - start);
+  return ground;
+}
+
+
+//is_ground from the engine GROUND_ENGINE
+vector<vector<int> > classify_ground() {
+  if (GROUND_ENGINE == GROUND_PMF) return pmf_ground();
+  if (GROUND_ENGINE == GROUND_CSF) return csf_ground();
+  return find_ground();
+}
+
+
+
+/* ************************************************************ */
+/* DELAUNAY TIN */
+/* delaunay() triangulates points in the plane with the sweep-hull
+   algorithm of Delaunator (V. Agafonkin): the points are added in
+   order of their distance to a seed triangle, each one connected to
+   the part of the convex hull it sees, and the new triangles are made
+   Delaunay by edge flips. A hash of the hull by angle around the seed
+   finds the visible part of the hull in O(1) expected.
+
+   The predicates are exact: the coordinates are quantized to integers
+   of at most TIN_BITS bits, so orient() fits in 64 bit integers and
+   in_circle() in 128 bit integers. With float inputs the quantization
+   loses nothing. Exact predicates also make duplicate points harmless:
+   they never see the hull, and are skipped.
+*/
+#define TIN_BITS 24
+
+//the triangulation under construction; see delaunay()
+typedef struct _triangulation {
+  const int64_t *x, *y;
+  vector<int> triangles; //3 vertices per triangle
+  vector<int> halfedges; //the opposite halfedge of every halfedge, or -1
+  vector<int> hull_prev, hull_next, hull_tri;
+  int hull_start;
+  vector<int> edge_stack;
+} triangulation;
+
+//true if r is strictly on the hull side of the directed edge p->q
+//that new points see; exact
+inline bool orient(const triangulation& T, int64_t px, int64_t py, int p2, int q) {
+  int64_t qx = T.x[p2], qy = T.y[p2], rx = T.x[q], ry = T.y[q];
+  return (qy - py)*(rx - qx) - (qx - px)*(ry - qy) < 0;
+}
+
+//true if p is strictly inside the circumcircle of a, b, c; exact
+inline bool in_circle(const triangulation& T, int a, int b, int c, int p) {
+  int64_t dx = T.x[a] - T.x[p], dy = T.y[a] - T.y[p];
+  int64_t ex = T.x[b] - T.x[p], ey = T.y[b] - T.y[p];
+  int64_t fx = T.x[c] - T.x[p], fy = T.y[c] - T.y[p];
+  __int128 ap = dx*dx + dy*dy, bp = ex*ex + ey*ey, cp = fx*fx + fy*fy;
+  return dx*(ey*cp - bp*fy) - dy*(ex*cp - bp*fx) + ap*(ex*fy - ey*fx) < 0;
+}
+
+inline void tri_link(triangulation& T, int a, int b) {
+  T.halfedges[a] = b;
+  if (b != -1) T.halfedges[b] = a;
+}
+
+int tri_add(triangulation& T, int i0, int i1, int i2, int a, int b, int c) {
+  int t = T.triangles.size();
+  T.triangles.push_back(i0);
+  T.triangles.push_back(i1);
+  T.triangles.push_back(i2);
+  T.halfedges.resize(t+3);
+  tri_link(T, t, a);
+  tri_link(T, t+1, b);
+  tri_link(T, t+2, c);
+  return t;
+}
+
+/* flip halfedge a and its opposite if they are not Delaunay, and
+   continue with the edges that the flip makes suspect:
+
+           pl                    pl
+          /||\                  /  \
+       al/ || \bl            al/    \a
+        /  ||  \              /      \
+       /  a||b  \    flip    /___ar___\
+     p0\   ||   /p1   =>   p0\---bl---/p1
+        \  ||  /              \      /
+       ar\ || /br             b\    /br
+          \||/                  \  /
+           pr                    pr
+*/
+int tri_legalize(triangulation& T, int a) {
+  int ar = 0;
+  T.edge_stack.clear();
+  while (1) {
+    int b = T.halfedges[a];
+    int a0 = a - a % 3;
+    ar = a0 + (a + 2) % 3;
+
+    if (b == -1) { //convex hull edge
+      if (T.edge_stack.empty()) break;
+      a = T.edge_stack.back();
+      T.edge_stack.pop_back();
+      continue;
+    }
+
+    int b0 = b - b % 3;
+    int al = a0 + (a + 1) % 3;
+    int bl = b0 + (b + 2) % 3;
+    int p0 = T.triangles[ar];
+    int pr = T.triangles[a];
+    int pl = T.triangles[al];
+    int p1 = T.triangles[bl];
+
+    if (in_circle(T, p0, pr, pl, p1)) {
+      T.triangles[a] = p1;
+      T.triangles[b] = p0;
+      int hbl = T.halfedges[bl];
+
+      //edge swapped on the other side of the hull (rare); fix the
+      //halfedge reference
+      if (hbl == -1) {
+	int e = T.hull_start;
+	do {
+	  if (T.hull_tri[e] == bl) {
+	    T.hull_tri[e] = a;
+	    break;
+	  }
+	  e = T.hull_prev[e];
+	} while (e != T.hull_start);
+      }
+      tri_link(T, a, hbl);
+      tri_link(T, b, T.halfedges[ar]);
+      tri_link(T, ar, bl);
+      T.edge_stack.push_back(b0 + (b + 1) % 3);
+    } else {
+      if (T.edge_stack.empty()) break;
+      a = T.edge_stack.back();
+      T.edge_stack.pop_back();
+    }
+  }
+  return ar;
+}
+
+//monotone in the angle of (dx,dy), in [0,1]
+inline double pseudo_angle(double dx, double dy) {
+  double p = dx / (fabs(dx) + fabs(dy));
+  return (dy > 0 ? 3 - p : 1 + p) / 4;
+}
+
+//squared circumradius of a, b, c; infinite or NaN if collinear
+double circumradius2(double ax, double ay, double bx, double by,
+		     double cx, double cy) {
+  double dx = bx - ax, dy = by - ay, ex = cx - ax, ey = cy - ay;
+  double bl = dx*dx + dy*dy, cl = ex*ex + ey*ey;
+  double d = 0.5 / (dx*ey - dy*ex);
+  double x = (ey*bl - dy*cl) * d, y = (dx*cl - ex*bl) * d;
+  return x*x + y*y;
+}
+
+
+/* Delaunay triangulation of the n points (x[i], y[i]), integers of at
+   most TIN_BITS bits. The triangles (3 vertex indices each, all with
+   the same orientation) go into triangles. Returns 0 if all points
+   are collinear. */
+int delaunay(int n, const int64_t* x, const int64_t* y, vector<int>& triangles) {
+  triangles.clear();
+  if (n < 3) return 0;
+
+  triangulation T;
+  T.x = x;
+  T.y = y;
+  int max_triangles = max(2*n - 5, 0);
+  T.triangles.reserve(3*max_triangles);
+  T.halfedges.reserve(3*max_triangles);
+  T.hull_prev.resize(n);
+  T.hull_next.resize(n);
+  T.hull_tri.resize(n);
+  int hash_size = ceil(sqrt((double)n));
+  vector<int> hull_hash(hash_size, -1);
+
+  //seed: the point closest to the centre of the bounding box, its
+  //closest point, and the point making the smallest circle with them
+  double minx_ = x[0], maxx_ = x[0], miny_ = y[0], maxy_ = y[0];
+  for (int i = 1; i < n; i++) {
+    minx_ = fmin(minx_, x[i]); maxx_ = fmax(maxx_, x[i]);
+    miny_ = fmin(miny_, y[i]); maxy_ = fmax(maxy_, y[i]);
+  }
+  double cx = (minx_ + maxx_)/2, cy = (miny_ + maxy_)/2;
+
+  int i0 = 0, i1 = -1, i2 = -1;
+  double min_d = INFINITY;
+  for (int i = 0; i < n; i++) {
+    double d = (x[i]-cx)*(x[i]-cx) + (y[i]-cy)*(y[i]-cy);
+    if (d < min_d) { i0 = i; min_d = d; }
+  }
+  min_d = INFINITY;
+  for (int i = 0; i < n; i++) {
+    if (i == i0) continue;
+    double d = (double)(x[i]-x[i0])*(x[i]-x[i0]) + (double)(y[i]-y[i0])*(y[i]-y[i0]);
+    if (d < min_d && d > 0) { i1 = i; min_d = d; }
+  }
+  if (i1 < 0) return 0; //all points equal
+  double min_r = INFINITY;
+  for (int i = 0; i < n; i++) {
+    if (i == i0 || i == i1) continue;
+    double r = circumradius2(x[i0], y[i0], x[i1], y[i1], x[i], y[i]);
+    if (r < min_r) { i2 = i; min_r = r; }
+  }
+  if (i2 < 0) return 0; //collinear
+
+  if (orient(T, x[i0], y[i0], i1, i2)) swap(i1, i2);
+
+  //circumcentre of the seed; the points are added in order of their
+  //distance to it, sorted by the parallel radix sort (non negative
+  //floats sort like their bit patterns)
+  double dx = x[i1] - x[i0], dy = y[i1] - y[i0];
+  double ex = x[i2] - x[i0], ey = y[i2] - y[i0];
+  double bl = dx*dx + dy*dy, cl = ex*ex + ey*ey;
+  double dd = 0.5 / (dx*ey - dy*ex);
+  cx = x[i0] + (ey*bl - dy*cl)*dd;
+  cy = y[i0] + (dx*cl - ex*bl)*dd;
+
+  vector<uint32_t> keys(n);
+  vector<int> ids(n);
+#pragma omp parallel for
+  for (int i = 0; i < n; i++) {
+    float d = (x[i]-cx)*(x[i]-cx) + (y[i]-cy)*(y[i]-cy);
+    memcpy(&keys[i], &d, sizeof(float));
+    ids[i] = i;
+  }
+  radix_sort(keys, ids);
+
+  T.hull_start = i0;
+  T.hull_next[i0] = T.hull_prev[i2] = i1;
+  T.hull_next[i1] = T.hull_prev[i0] = i2;
+  T.hull_next[i2] = T.hull_prev[i1] = i0;
+  T.hull_tri[i0] = 0;
+  T.hull_tri[i1] = 1;
+  T.hull_tri[i2] = 2;
+
+#define HASH_KEY(px, py) \
+  ((int)floor(pseudo_angle((px) - cx, (py) - cy) * hash_size) % hash_size)
+  hull_hash[HASH_KEY(x[i0], y[i0])] = i0;
+  hull_hash[HASH_KEY(x[i1], y[i1])] = i1;
+  hull_hash[HASH_KEY(x[i2], y[i2])] = i2;
+
+  tri_add(T, i0, i1, i2, -1, -1, -1);
+
+  for (int k = 0; k < n; k++) {
+    int i = ids[k];
+    int64_t px = x[i], py = y[i];
+    if (i == i0 || i == i1 || i == i2) continue;
+
+    //find a visible edge on the convex hull using the hash
+    int start = 0;
+    int key = HASH_KEY(px, py);
+    for (int j = 0; j < hash_size; j++) {
+      start = hull_hash[(key + j) % hash_size];
+      if (start != -1 && start != T.hull_next[start]) break;
+    }
+    start = T.hull_prev[start];
+    int e = start, q;
+    while (q = T.hull_next[e], !orient(T, px, py, e, q)) {
+      e = q;
+      if (e == start) {
+	e = -1;
+	break;
+      }
+    }
+    if (e == -1) continue; //a duplicate point; it sees no edge
+
+    //add the first triangle from the point
+    int t = tri_add(T, e, i, T.hull_next[e], -1, -1, T.hull_tri[e]);
+    T.hull_tri[i] = tri_legalize(T, t + 2);
+    T.hull_tri[e] = t;
+
+    //walk forward through the hull, adding more triangles and flipping
+    int nx = T.hull_next[e];
+    while (q = T.hull_next[nx], orient(T, px, py, nx, q)) {
+      t = tri_add(T, nx, i, q, T.hull_tri[i], -1, T.hull_tri[nx]);
+      T.hull_tri[i] = tri_legalize(T, t + 2);
+      T.hull_next[nx] = nx; //removed from the hull
+      nx = q;
+    }
+
+    //walk backward from the other side
+    if (e == start) {
+      while (q = T.hull_prev[e], orient(T, px, py, q, e)) {
+	t = tri_add(T, q, i, e, -1, T.hull_tri[e], T.hull_tri[q]);
+	tri_legalize(T, t + 2);
+	T.hull_tri[q] = t;
+	T.hull_next[e] = e; //removed from the hull
+	e = q;
+      }
+    }
+
+    //update the hull
+    T.hull_start = T.hull_prev[i] = e;
+    T.hull_next[e] = T.hull_prev[nx] = i;
+    T.hull_next[i] = nx;
+
+    hull_hash[HASH_KEY(px, py)] = i;
+    hull_hash[HASH_KEY(x[e], y[e])] = e;
+  }
+#undef HASH_KEY
+
+  triangles.swap(T.triangles);
+  return 1;
+}
+
+
+/* rasterize the TIN into grid: every cell whose centre is in a
+   triangle gets the z of the triangle's plane there; the other cells
+   are NODATA. The centres are tested with exact integer orientations
+   and a top-left rule for centres on an edge, so every centre belongs
+   to exactly one triangle and the triangles can be rasterized in
+   parallel without conflicts. */
+void rasterize_tin(const int64_t* qx, const int64_t* qy, double scale,
+		   vector<vector<float> >& grid) {
+  grid.assign(grid_rows, vector<float>(grid_cols, NODATA));
+  int ntri = tin_triangles.size()/3;
+
+  //orientation of the triangles; they all have the same
+  int sign = 1;
+  if (ntri > 0) {
+    int a = tin_triangles[0], b = tin_triangles[1], c = tin_triangles[2];
+    if ((qx[b]-qx[a])*(qy[c]-qy[a]) - (qy[b]-qy[a])*(qx[c]-qx[a]) < 0) sign = -1;
+  }
+
+#pragma omp parallel for schedule(dynamic, 1024)
+  for (int t = 0; t < ntri; t++) {
+    int v[3] = {tin_triangles[3*t], tin_triangles[3*t+1], tin_triangles[3*t+2]};
+    if (sign < 0) swap(v[1], v[2]); //counterclockwise from now on
+
+    //bounding box of the triangle, in cells
+    double x0 = min(qx[v[0]], min(qx[v[1]], qx[v[2]])) / scale;
+    double x1 = max(qx[v[0]], max(qx[v[1]], qx[v[2]])) / scale;
+    double y0 = min(qy[v[0]], min(qy[v[1]], qy[v[2]])) / scale;
+    double y1 = max(qy[v[0]], max(qy[v[1]], qy[v[2]])) / scale;
+    int c0 = max((int)floor(x0/cell_size - 0.5), 0);
+    int c1 = min((int)ceil(x1/cell_size - 0.5), grid_cols - 1);
+    int r0 = max((int)floor(y0/cell_size - 0.5), 0);
+    int r1 = min((int)ceil(y1/cell_size - 0.5), grid_rows - 1);
+
+    //area, for the barycentric coordinates
+    int64_t area = (qx[v[1]]-qx[v[0]])*(qy[v[2]]-qy[v[0]]) -
+      (qy[v[1]]-qy[v[0]])*(qx[v[2]]-qx[v[0]]);
+    if (area == 0) continue;
+
+    for (int r = r0; r <= r1; r++) {
+      for (int c = c0; c <= c1; c++) {
+	//cell centre, quantized like the vertices
+	int64_t px = llround((c + 0.5)*cell_size*scale);
+	int64_t py = llround((r + 0.5)*cell_size*scale);
+
+	int64_t w[3];
+	int inside = 1;
+	for (int k = 0; k < 3 && inside; k++) {
+	  int a = v[(k+1)%3], b = v[(k+2)%3];
+	  int64_t ex = qx[b] - qx[a], ey = qy[b] - qy[a];
+	  w[k] = ex*(py - qy[a]) - ey*(px - qx[a]);
+	  //top-left rule: of the two triangles sharing an edge, only
+	  //one owns the centres on it
+	  int owns_edge = (ey < 0) || (ey == 0 && ex > 0);
+	  if (w[k] < 0 || (w[k] == 0 && !owns_edge)) inside = 0;
+	}
+	if (!inside) continue;
+
+	grid[r][c] = (w[0]*(double)tin_xyz[3*v[0]+2] +
+		      w[1]*(double)tin_xyz[3*v[1]+2] +
+		      w[2]*(double)tin_xyz[3*v[2]+2]) / area;
+      }
+    }
+  }
+}
+
+
+/* triangulate the ground (see TIN_SOURCE) and rasterize the TIN into
+   elevation, which then holds a bare earth surface */
+void build_ground_tin() {
+  tin_xyz.clear();
+  if (TIN_SOURCE == TIN_CODE) {
+    for (unsigned int i = 0; i < points.size(); i++) {
+      if (points[i].code != 2) continue;
+      tin_xyz.push_back(points[i].x);
+      tin_xyz.push_back(points[i].y);
+      tin_xyz.push_back(points[i].z);
+    }
+  } else {
+    for (int i = 0; i < grid_rows; i++) {
+      for (int j = 0; j < grid_cols; j++) {
+	if (is_ground[i][j] != 1 || last_grid[i][j] == NODATA) continue;
+	tin_xyz.push_back(minx + (j + 0.5)*cell_size);
+	tin_xyz.push_back(miny + (i + 0.5)*cell_size);
+	tin_xyz.push_back(last_grid[i][j]);
+      }
+    }
+  }
+  int n = tin_xyz.size()/3;
+  if (n < 3) {
+    printf("TIN: too few ground points (%d); no TIN\n", n);
+    tin_triangles.clear();
+    return;
+  }
+  double start = omp_get_wtime();
+
+  //quantize relative to the bounding box
+  double extent = fmax(fmax(maxx - minx, maxy - miny), 1e-6);
+  double scale = ((1 << TIN_BITS) - 1) / extent;
+  vector<int64_t> qx(n), qy(n);
+#pragma omp parallel for
+  for (int v = 0; v < n; v++) {
+    qx[v] = llround((tin_xyz[3*v] - minx)*scale);
+    qy[v] = llround((tin_xyz[3*v+1] - miny)*scale);
+  }
+
+  if (!delaunay(n, &qx[0], &qy[0], tin_triangles)) {
+    printf("TIN: the %d ground points are collinear; no TIN\n", n);
+    tin_triangles.clear();
+    return;
+  }
+  double mid = omp_get_wtime();
+
+  rasterize_tin(&qx[0], &qy[0], scale, elevation);
+  printf("TIN: %d ground points, %d triangles in %.2fs, rasterized in %.2fs\n",
+	 n, (int)tin_triangles.size()/3, mid - start, omp_get_wtime() - mid);
+}
+
+
+
+
+/* ************************************************************ */
+/* SLOPE AND ASPECT */
+/* The gradient of each cell comes from Horn's 3x3 kernel over its 8
+   neighbours (rows run north along y, columns east along x):
+
+     dz/dx = ((ne + 2e + se) - (nw + 2w + sw)) / (8 cell_size)
+     dz/dy = ((nw + 2n + ne) - (sw + 2s + se)) / (8 cell_size)
+
+   A NODATA neighbour, or one off the grid, takes the value of the
+   centre cell, so holes and borders flatten the kernel instead of
+   spiking it. The three rows are copied into buffers padded with
+   NODATA, so the kernel loop has no bounds tests and the substitution
+   is a select; the compiler can vectorize it.
+*/
+
+//copy grid row r into buf[0..cols+1], padded by one NODATA cell on
+//each side; all NODATA if r is off the grid
+void padded_row(const vector<vector<float> >& grid, int r, float* buf) {
+  int cols = grid[0].size();
+  buf[0] = buf[cols+1] = NODATA;
+  if (r < 0 || r >= (int)grid.size()) {
+    for (int j = 1; j <= cols; j++) buf[j] = NODATA;
+    return;
+  }
+  for (int j = 0; j < cols; j++) buf[j+1] = grid[r][j];
+}
+
+//v, or z if v is NODATA
+inline float or_centre(float v, float z) {
+  return (v == NODATA) ? z : v;
+}
+
+
+//compute slope_deg, slope_pct and aspect of grid in one pass
+void compute_slope_aspect(const vector<vector<float> >& grid) {
+  int rows = grid.size();
+  int cols = grid[0].size();
+  cell_normal.resize(3*rows*cols);
+  slope_deg.assign(rows, vector<float>(cols, NODATA));
+  slope_pct.assign(rows, vector<float>(cols, NODATA));
+  aspect.assign(rows, vector<float>(cols, NODATA));
+  float k = 1.0/(8*cell_size);
+
+#pragma omp parallel
+  {
+    vector<float> s(cols+2), c(cols+2), n(cols+2);
+    vector<float> gx(cols), gy(cols);
+#pragma omp for schedule(static)
+    for (int i = 0; i < rows; i++) {
+      const vector<float>& centre = grid[i];
+      padded_row(grid, i-1, &s[0]);
+      padded_row(grid, i, &c[0]);
+      padded_row(grid, i+1, &n[0]);
+
+      //cell j is at j+1 in the padded rows
+      for (int j = 0; j < cols; j++) {
+	float z = c[j+1];
+	float nw = or_centre(n[j], z), nn = or_centre(n[j+1], z);
+	float ne = or_centre(n[j+2], z), ww = or_centre(c[j], z);
+	float ee = or_centre(c[j+2], z), sw = or_centre(s[j], z);
+	float ss = or_centre(s[j+1], z), se = or_centre(s[j+2], z);
+	gx[j] = ((ne + 2*ee + se) - (nw + 2*ww + sw))*k;
+	gy[j] = ((nw + 2*nn + ne) - (sw + 2*ss + se))*k;
+      }
+
+      for (int j = 0; j < cols; j++) {
+	float* nrm = &cell_normal[3*(i*cols + j)];
+	if (centre[j] == NODATA) {
+	  nrm[0] = nrm[1] = 0;
+	  nrm[2] = 1;
+	  continue;
+	}
+	float g = sqrt(gx[j]*gx[j] + gy[j]*gy[j]);
+	float inv = 1/sqrt(g*g + 1);
+	nrm[0] = -gx[j]*inv;
+	nrm[1] = -gy[j]*inv;
+	nrm[2] = inv;
+
+	slope_pct[i][j] = 100*g;
+	slope_deg[i][j] = atan(g)*180/M_PI;
+	if (g == 0) {
+	  aspect[i][j] = -1;
+	} else {
+	  //the downslope direction is -gradient
+	  float a = atan2(-gx[j], -gy[j])*180/M_PI;
+	  //fabs turns the -0 of due north into 0
+	  aspect[i][j] = (a < 0) ? a + 360 : fabs(a);
+	}
+      }
+    }
+  }
+}
+
+
+
+/* ************************************************************ */
+/* SUN */
+/* The shade of a surface with upward unit normal n is n.s, where s is
+   the unit vector toward the sun. The grid keeps its normals in
+   cell_normal, so moving the sun costs one dot product per cell and
+   no derivatives.
+
+   A single sun hides ridges and valleys that run parallel to it. With
+   SUN_DIRECTIONS > 1 the shade blends that many suns at sun_altitude,
+   spread evenly over the half circle centred on sun_azimuth. Each sun
+   is weighted by cos^2 of the angle between its azimuth and the aspect
+   of the surface, so a slope is shaded mostly by the suns that shine
+   up or down it; flat cells weigh all suns the same.
+*/
+float sun_dir[MAX_SUN_DIRECTIONS][3]; //toward each sun: east, north, up
+float sun_horizontal[MAX_SUN_DIRECTIONS][2]; //unit azimuth of each sun
+
+//recompute sun_dir from sun_azimuth, sun_altitude and SUN_DIRECTIONS
+void set_sun() {
+  float alt = sun_altitude*M_PI/180;
+  for (int k = 0; k < SUN_DIRECTIONS; k++) {
+    float offset = (k - (SUN_DIRECTIONS - 1)/2.0)*180.0/SUN_DIRECTIONS;
+    float az = (sun_azimuth + offset)*M_PI/180;
+    sun_horizontal[k][0] = sin(az);
+    sun_horizontal[k][1] = cos(az);
+    sun_dir[k][0] = cos(alt)*sin(az);
+    sun_dir[k][1] = cos(alt)*cos(az);
+    sun_dir[k][2] = sin(alt);
+  }
+}
+
+//shade of a surface with upward unit normal n (east, north, up); bit
+//k of lit is clear if sun k is hidden by the terrain
+float sun_shade(const float* n, int lit) {
+  if (SUN_DIRECTIONS == 1) {
+    float d = n[0]*sun_dir[0][0] + n[1]*sun_dir[0][1] + n[2]*sun_dir[0][2];
+    return (lit & 1) ? d : d*SHADOW_LIGHT;
+  }
+
+  float h2 = n[0]*n[0] + n[1]*n[1];
+  float shade = 0, weights = 0;
+  for (int k = 0; k < SUN_DIRECTIONS; k++) {
+    float d = n[0]*sun_dir[k][0] + n[1]*sun_dir[k][1] + n[2]*sun_dir[k][2];
+    if (!(lit & (1 << k))) d *= SHADOW_LIGHT;
+    float w = 1;
+    if (h2 > 1e-12) {
+      float c = n[0]*sun_horizontal[k][0] + n[1]*sun_horizontal[k][1];
+      w = c*c/h2;
+    }
+    shade += w*d;
+    weights += w;
+  }
+  return shade/weights;
+}
+
+
+
+/* ************************************************************ */
+/* CAST SHADOWS */
+/* A cell is in the shadow of sun k if some cell between it and the
+   sun rises above the line from the cell to the sun. Walking a line
+   of cells in the direction the light travels, the top of the shadow
+   at step m is
+
+     h[m] = max(h[m-1], z[m-1]) - step*tan(altitude)
+
+   so one pass along the line decides every cell on it: O(1) per cell.
+
+   The lines are set up by sweep_setup(), and shared with the sky
+   view (see SKY VIEW).
+*/
+
+/* The parallel lines of cells that sweep a grid in a direction. They
+   advance one cell per step along the axis closest to the direction
+   (the major axis) and a fraction of a cell along the other one; the
+   offset of step m is rounded the same way on every line, so the lines
+   that start at consecutive whole offsets visit every cell of the grid
+   exactly once. They are independent and can run in parallel. */
+typedef struct _sweepLines {
+  int rows, cols;
+  int along_cols;  //1 if the major axis runs along the columns
+  int major_len, minor_len;
+  int major_step, major_start;
+  float slope;     //minor cells per major step
+  float step_len;  //length of a step, in cells
+  int first, last; //the lines are first..last-1
+} sweepLines;
+
+//lines sweeping a rows x cols grid in direction (dc, dr), in (col, row)
+//= (east, north)
+sweepLines sweep_setup(int rows, int cols, float dc, float dr) {
+  sweepLines sw;
+  sw.rows = rows;
+  sw.cols = cols;
+  sw.along_cols = fabs(dc) >= fabs(dr);
+  sw.major_len = sw.along_cols ? cols : rows;
+  sw.minor_len = sw.along_cols ? rows : cols;
+  float major_dir = sw.along_cols ? dc : dr;
+  float minor_dir = sw.along_cols ? dr : dc;
+  sw.major_step = (major_dir >= 0) ? 1 : -1;
+  sw.major_start = (sw.major_step > 0) ? 0 : sw.major_len - 1;
+  sw.slope = minor_dir/fabs(major_dir);
+  sw.step_len = sqrt(1 + sw.slope*sw.slope);
+  int extent = ceil(fabs(sw.slope)*(sw.major_len - 1));
+  sw.first = -extent;
+  sw.last = sw.minor_len + extent;
+  return sw;
+}
+
+//the cell i*cols+j at step m of line, or -1 if it is off the grid
+inline int sweep_cell(const sweepLines& sw, int line, int m) {
+  int minor = line + (int)floor(m*sw.slope + 0.5);
+  if (minor < 0 || minor >= sw.minor_len) return -1;
+  int major = sw.major_start + m*sw.major_step;
+  return sw.along_cols ? minor*sw.cols + major : major*sw.cols + minor;
+}
+
+
+//sweep the lines of sun k over grid, setting bit k of cell_lit in the
+//cells it reaches
+void cast_shadow(const vector<vector<float> >& grid, int k) {
+  int cols = grid[0].size();
+  unsigned char bit = 1 << k;
+
+  //the light travels away from the sun
+  sweepLines sw = sweep_setup(grid.size(), cols,
+			      -sun_horizontal[k][0], -sun_horizontal[k][1]);
+  float drop = cell_size*sw.step_len*tan(sun_altitude*M_PI/180);
+
+#pragma omp parallel for schedule(dynamic, 16)
+  for (int line = sw.first; line < sw.last; line++) {
+    float h = -BIGINT; //top of the shadow at the current cell
+    for (int m = 0; m < sw.major_len; m++, h -= drop) {
+      int c = sweep_cell(sw, line, m);
+      if (c < 0) continue;
+      float z = grid[c / cols][c % cols];
+      if (z == NODATA) {
+	cell_lit[c] |= bit;
+	continue;
+      }
+      if (z >= h) cell_lit[c] |= bit;
+      h = max(h, z);
+    }
+  }
+}
+
+
+//recompute cell_lit for the suns of set_sun(); prints the part of the
+//grid in the shadow of the first sun
+void compute_shadows() {
+  int rows = elevation.size();
+  int cols = elevation[0].size();
+  cell_lit.assign(rows*cols, 0);
+  for (int k = 0; k < SUN_DIRECTIONS; k++) {
+    if (sun_altitude >= 90) {
+      for (int c = 0; c < rows*cols; c++) cell_lit[c] |= 1 << k;
+    } else {
+      cast_shadow(elevation, k);
+    }
+  }
+
+  int valid = 0, shadowed = 0;
+  for (int i = 0; i < rows; i++) {
+    for (int j = 0; j < cols; j++) {
+      if (elevation[i][j] == NODATA) continue;
+      valid++;
+      if (!(cell_lit[i*cols + j] & 1)) shadowed++;
+    }
+  }
+  printf("shadows: %.1f%% of the cells\n", 100.0*shadowed/max(valid, 1));
+}
+
+
+
+/* ************************************************************ */
+/* SKY VIEW */
+/* The sky view factor of a cell is the part of the sky it sees. With
+   the horizon angles g[k] of n directions around the cell it is
+
+     svf = 1 - sum_k sin(g[k]) / n
+
+   1 on an open plain, lower in streets, courtyards and valleys. As a
+   shade it reads well where a directional sun doesn't: it has no
+   preferred direction.
+
+   The horizon in direction d is found for all cells at once by
+   walking the sweep lines (see CAST SHADOWS) in direction -d, so the
+   cells that can be the horizon of a cell are walked before it. The
+   upper convex hull of the cells walked so far is kept on a stack;
+   the horizon of the next cell is its tangent to the hull. Cells
+   under the tangent can never be a horizon again and are popped, so
+   a line costs O(its length) and the horizon is exact, with no
+   search radius. The directions run one after the other; the lines
+   of a direction run in parallel.
+*/
+
+//add sin of the horizon angle in direction (dc, dr), in (col, row),
+//of every cell of grid to sum
+void add_horizons(const vector<vector<float> >& grid, float dc, float dr,
+		  vector<float>& sum) {
+  int cols = grid[0].size();
+  sweepLines sw = sweep_setup(grid.size(), cols, -dc, -dr);
+  float step = cell_size*sw.step_len;
+
+#pragma omp parallel
+  {
+    //the hull: distance along the line and height of its cells
+    vector<float> hu, hz;
+#pragma omp for schedule(dynamic, 16)
+    for (int line = sw.first; line < sw.last; line++) {
+      hu.clear();
+      hz.clear();
+      for (int m = 0; m < sw.major_len; m++) {
+	int c = sweep_cell(sw, line, m);
+	if (c < 0) continue;
+	float z = grid[c / cols][c % cols];
+	if (z == NODATA) continue;
+	float u = m*step;
+
+	//pop the top while the one under it is at least as steep
+	int top = hu.size() - 1;
+	while (top >= 1 &&
+	       (hz[top-1] - z)*(u - hu[top]) >= (hz[top] - z)*(u - hu[top-1])) {
+	  top--;
+	}
+	hu.resize(top + 1);
+	hz.resize(top + 1);
+
+	if (top >= 0 && hz[top] > z) {
+	  float t = (hz[top] - z)/(u - hu[top]); //tan of the horizon angle
+	  sum[c] += t/sqrt(1 + t*t);
+	}
+	hu.push_back(u);
+	hz.push_back(z);
+      }
+    }
+  }
+}
+
+
+//compute sky_view of elevation from SKY_DIRECTIONS directions
+void compute_sky_view() {
+  int rows = elevation.size();
+  int cols = elevation[0].size();
+  double start = omp_get_wtime();
+
+  vector<float> sum(rows*cols, 0);
+  for (int k = 0; k < SKY_DIRECTIONS; k++) {
+    float az = 2*M_PI*k/SKY_DIRECTIONS;
+    add_horizons(elevation, sin(az), cos(az), sum);
+  }
+
+  sky_view.assign(rows, vector<float>(cols, NODATA));
+  double total = 0;
+  int valid = 0;
+  for (int i = 0; i < rows; i++) {
+    for (int j = 0; j < cols; j++) {
+      if (elevation[i][j] == NODATA) continue;
+      sky_view[i][j] = 1 - sum[i*cols + j]/SKY_DIRECTIONS;
+      total += sky_view[i][j];
+      valid++;
+    }
+  }
+  printf("sky view: %d directions, mean %.3f, in %.2fs\n", SKY_DIRECTIONS,
+	 total/max(valid, 1), omp_get_wtime() - start);
+}
+
+
+
+/* ************************************************************ */
+/* VIEWSHED */
+/* The cells visible from an observer, with an XDraw sweep. The cells
+   are visited in square rings of growing Chebyshev distance r around
+   the observer. The ray from the observer to a cell of ring r crosses
+   ring r-1 between two cells; the steepest line of sight up to there
+   is interpolated between the two:
+
+     s[cell] = max((z[cell] - z_obs)/dist, interpolated s of ring r-1)
+
+   and the cell is visible if its own slope is at least the
+   interpolated one. One pass over the grid per observer, O(cells);
+   the interpolation makes it approximate, like every XDraw, but close
+   to the exact line of sight on DEMs.
+
+   Many observers run in parallel, one per thread, each with its own
+   slope buffer; viewshed counts the observers that see each cell.
+*/
+
+//mark in visible (rows*cols, zeroed by the caller) the cells of grid
+//seen from cell (oi,oj) with the eye at height eye. A NODATA cell
+//neither blocks nor is visible
+void xdraw(const vector<vector<float> >& grid, int oi, int oj, float eye,
+	   vector<float>& los, unsigned char* visible) {
+  int rows = grid.size();
+  int cols = grid[0].size();
+  int rmax = max(max(oi, rows - 1 - oi), max(oj, cols - 1 - oj));
+  los.assign(rows*cols, -BIGINT);
+  visible[oi*cols + oj] = 1;
+
+  for (int r = 1; r <= rmax; r++) {
+    //walk the ring: di = +-r with any dj, then dj = +-r with |di| < r
+    for (int k = 0; k < 8*r; k++) {
+      int di, dj;
+      if (k < 2*r + 1) { di = -r; dj = k - r; }
+      else if (k < 4*r + 2) { di = r; dj = k - 3*r - 1; }
+      else if (k < 6*r + 1) { dj = -r; di = k - 5*r - 1; }
+      else { dj = r; di = k - 7*r; }
+      int i = oi + di, j = oj + dj;
+      if (i < 0 || i >= rows || j < 0 || j >= cols) continue;
+
+      //the crossing of ring r-1, between cells a and b
+      float s_inner;
+      if (r == 1) {
+	s_inner = -BIGINT;
+      } else if (abs(dj) == r) {
+	float t = di*(r - 1.0)/r;
+	int lo = floor(t);
+	float f = t - lo;
+	int jj = oj + dj - (dj > 0 ? 1 : -1);
+	float a = los[(oi + lo)*cols + jj];
+	float b = (f > 0) ? los[(oi + lo + 1)*cols + jj] : a;
+	s_inner = a + f*(b - a);
+      } else {
+	float t = dj*(r - 1.0)/r;
+	int lo = floor(t);
+	float f = t - lo;
+	int ii = oi + di - (di > 0 ? 1 : -1);
+	float a = los[ii*cols + oj + lo];
+	float b = (f > 0) ? los[ii*cols + oj + lo + 1] : a;
+	s_inner = a + f*(b - a);
+      }
+
+      float z = grid[i][j];
+      if (z == NODATA) {
+	los[i*cols + j] = s_inner;
+	continue;
+      }
+      float s = (z - eye)/(cell_size*sqrt((float)(di*di + dj*dj)));
+      if (s >= s_inner) visible[i*cols + j] = 1;
+      los[i*cols + j] = max(s, s_inner);
+    }
+  }
+}
+
+
+//compute viewshed of elevation for all the observers
+void compute_viewsheds() {
+  int rows = elevation.size();
+  int cols = elevation[0].size();
+  double start = omp_get_wtime();
+  vector<int> count(rows*cols, 0);
+  int used = 0;
+
+#pragma omp parallel
+  {
+    vector<float> los;
+    vector<unsigned char> visible(rows*cols);
+#pragma omp for schedule(dynamic, 1) reduction(+:used)
+    for (int o = 0; o < (int)observers.size(); o++) {
+      int i = floor((observers[o].y - miny)/cell_size);
+      int j = floor((observers[o].x - minx)/cell_size);
+      if (i < 0 || i >= rows || j < 0 || j >= cols ||
+	  elevation[i][j] == NODATA) {
+	printf("observer (%.2f, %.2f) is off the grid or on NODATA; skipped\n",
+	       observers[o].x, observers[o].y);
+	continue;
+      }
+      fill(visible.begin(), visible.end(), 0);
+      xdraw(elevation, i, j, elevation[i][j] + observers[o].height,
+	    los, &visible[0]);
+      for (int c = 0; c < rows*cols; c++) {
+	if (visible[c]) {
+#pragma omp atomic
+	  count[c]++;
+	}
+      }
+      used++;
+    }
+  }
+
+  viewshed.assign(rows, vector<float>(cols, 0));
+  int seen = 0;
+  for (int i = 0; i < rows; i++) {
+    for (int j = 0; j < cols; j++) {
+      viewshed[i][j] = count[i*cols + j];
+      if (count[i*cols + j] > 0) seen++;
+    }
+  }
+  printf("viewshed: %d observers see %.1f%% of the cells, in %.2fs\n",
+	 used, 100.0*seen/(rows*cols), omp_get_wtime() - start);
+}
+
+
+//add the observers listed in fname, one "x y height" per line
+void read_observers(const char* fname) {
+  FILE* f = fopen(fname, "r");
+  if (!f) {
+    printf("cannot open %s\n", fname);
+    exit(1);
+  }
+  observer o;
+  while (fscanf(f, "%f %f %f", &o.x, &o.y, &o.height) == 3) {
+    observers.push_back(o);
+  }
+  fclose(f);
+}
+
+
+
+/* ************************************************************ */
+/* CANOPY HEIGHT */
+/* The canopy height model is the height of the highest first return
+   of each cell above the ground. Both the surface (max:first) and the
+   canopy cover come out of the gridding sweep of compute_cell_stats(),
+   so the points are walked once; the ground is last_grid on the cells
+   find_ground() calls ground, interpolated under the rest.
+
+   The laser sometimes goes deep into a crown before its first return,
+   which leaves pits in the CHM. A cell more than CHM_PIT_DEPTH below
+   the median of its 8 neighbours is a pit and takes that median.
+
+   The canopy cover of a cell is the part of its first returns that
+   come from pulses with several returns: ground and roofs return one
+   echo per pulse, while foliage lets part of the pulse through.
+*/
+
+//the ground under the whole grid: last_grid on the ground cells,
+//interpolated elsewhere; NODATA only if there is no ground at all
+void ground_surface(vector<vector<float> >& dem) {
+  int rows = last_grid.size();
+  int cols = last_grid[0].size();
+  dem.assign(rows, vector<float>(cols, NODATA));
+  for (int i = 0; i < rows; i++) {
+    for (int j = 0; j < cols; j++) {
+      if (is_ground[i][j] == 1) dem[i][j] = last_grid[i][j];
+    }
+  }
+  fill_nodata(dem, rows + cols);
+}
+
+
+//turn chm from the canopy surface into heights above the ground and
+//fill its pits
+void compute_chm() {
+  int rows = chm.size();
+  int cols = chm[0].size();
+  vector<vector<float> > ground;
+  ground_surface(ground);
+
+  for (int i = 0; i < rows; i++) {
+    for (int j = 0; j < cols; j++) {
+      if (chm[i][j] == NODATA || ground[i][j] == NODATA) {
+	chm[i][j] = NODATA;
+      } else {
+	chm[i][j] = max(0.0f, chm[i][j] - ground[i][j]);
+      }
+    }
+  }
+
+  vector<vector<float> > raw(chm);
+  int pits = 0;
+#pragma omp parallel for schedule(static) reduction(+:pits)
+  for (int i = 0; i < rows; i++) {
+    float nb[8];
+    for (int j = 0; j < cols; j++) {
+      if (raw[i][j] == NODATA) continue;
+      int n = 0;
+      for (int di = -1; di <= 1; di++) {
+	for (int dj = -1; dj <= 1; dj++) {
+	  int ni = i + di, nj = j + dj;
+	  if ((di || dj) && ni >= 0 && ni < rows && nj >= 0 && nj < cols &&
+	      raw[ni][nj] != NODATA) {
+	    nb[n++] = raw[ni][nj];
+	  }
+	}
+      }
+      if (n < 3) continue;
+      float median = percentile(nb, n, 50);
+      if (raw[i][j] < median - CHM_PIT_DEPTH) {
+	chm[i][j] = median;
+	pits++;
+      }
+    }
+  }
+
+  float highest = 0;
+  double cover = 0;
+  int valid = 0;
+  for (int i = 0; i < rows; i++) {
+    for (int j = 0; j < cols; j++) {
+      if (chm[i][j] != NODATA) highest = max(highest, chm[i][j]);
+      if (canopy_cover[i][j] != NODATA) {
+	cover += canopy_cover[i][j];
+	valid++;
+      }
+    }
+  }
+  printf("canopy: highest %.2f above the ground, %d pits filled, mean cover %.2f\n",
+	 highest, pits, cover/max(valid, 1));
+}
+
+
+
+/* ************************************************************ */
+/* BUILDINGS */
+/* The building cells of is_ground are labelled into 4-connected
+   components with a union-find. The grid is cut into bands of rows
+   that are labelled in parallel, each touching only the parents of
+   its own cells; then the unions across the seams between bands are
+   done, and finally every cell finds its root, in parallel again.
+
+   The footprint of a building is the outer boundary of its cells.
+   Every side of a cell that faces a cell of another label is a
+   directed edge, counterclockwise around the cell, so the boundaries
+   of the component are loops with the building on the left: the
+   outer one counterclockwise, the holes clockwise. The loops are
+   followed from edge to edge turning right first, which keeps apart
+   two cells that only touch at a corner, as the 4-connected labels
+   do; a courtyard that touches the outside at a corner is then inside
+   a simple outer loop. A loop ends when it is back at its start. The
+   largest counterclockwise loop is simplified with Douglas-Peucker,
+   keeping at least a triangle. The buildings are traced in parallel.
+*/
+#define BUILDING_BAND 64 //rows per band of the labelling
+
+int uf_find(vector<int>& parent, int c) {
+  while (parent[c] != c) {
+    parent[c] = parent[parent[c]]; //path halving
+    c = parent[c];
+  }
+  return c;
+}
+
+void uf_union(vector<int>& parent, int a, int b) {
+  a = uf_find(parent, a);
+  b = uf_find(parent, b);
+  //the smaller index is the root, so the result doesn't depend on
+  //the order of the unions
+  if (a < b) parent[b] = a;
+  else if (b < a) parent[a] = b;
+}
+
+
+//Douglas-Peucker on the open polyline pts[2a..2b] (x,y pairs); marks in
+//keep the points that stay
+void simplify_polyline(const vector<float>& pts, int a, int b, float tol,
+		       vector<unsigned char>& keep) {
+  vector<pair<int, int> > todo;
+  todo.push_back(make_pair(a, b));
+  while (todo.size() > 0) {
+    a = todo.back().first;
+    b = todo.back().second;
+    todo.pop_back();
+    float ax = pts[2*a], ay = pts[2*a+1];
+    float dx = pts[2*b] - ax, dy = pts[2*b+1] - ay;
+    float len = sqrt(dx*dx + dy*dy);
+    float far = 0;
+    int far_k = -1;
+    for (int k = a + 1; k < b; k++) {
+      float px = pts[2*k] - ax, py = pts[2*k+1] - ay;
+      float d = (len > 0) ? fabs(px*dy - py*dx)/len : sqrt(px*px + py*py);
+      if (d > far) {
+	far = d;
+	far_k = k;
+      }
+    }
+    if (far_k >= 0 && far > tol) {
+      keep[far_k] = 1;
+      todo.push_back(make_pair(a, far_k));
+      todo.push_back(make_pair(far_k, b));
+    }
+  }
+}
+
+
+//the slope in degrees of last_grid at cell (i,j) of building label,
+//with Horn's kernel (see SLOPE AND ASPECT). Neighbours outside the
+//building take the value of the centre, so walls don't count; sets
+//*interior to whether there were none
+float roof_cell_slope(int i, int j, int label, int* interior) {
+  int rows = last_grid.size();
+  int cols = last_grid[0].size();
+  float z = last_grid[i][j];
+  float v[3][3];
+  *interior = 1;
+  for (int di = -1; di <= 1; di++) {
+    for (int dj = -1; dj <= 1; dj++) {
+      int r = i + di, c = j + dj;
+      if (r < 0 || c < 0 || r >= rows || c >= cols ||
+	  building_id[r][c] != label || last_grid[r][c] == NODATA) {
+	v[di+1][dj+1] = z;
+	*interior = 0;
+      } else {
+	v[di+1][dj+1] = last_grid[r][c];
+      }
+    }
+  }
+  //v[0] is the row to the south, v[2] the one to the north
+  float gx = ((v[2][2] + 2*v[1][2] + v[0][2]) - (v[2][0] + 2*v[1][0] + v[0][0]))
+    /(8*cell_size);
+  float gy = ((v[2][0] + 2*v[2][1] + v[2][2]) - (v[0][0] + 2*v[0][1] + v[0][2]))
+    /(8*cell_size);
+  return atan(sqrt(gx*gx + gy*gy))*180/M_PI;
+}
+
+
+//the outer boundary of the cells of building label (1 + index), as
+//the corners of the cell grid (row, col) where it turns
+vector<float> trace_footprint(const vector<int>& cells, int label) {
+  int rows = building_id.size();
+  int cols = building_id[0].size();
+  //directions east, north, west, south, counterclockwise
+  const int DI[4] = {0, 1, 0, -1};
+  const int DJ[4] = {1, 0, -1, 0};
+
+  //the boundary edges as corner*4 + direction; corner (i,j) of the
+  //cell grid is i*(cols+1)+j
+  unordered_map<long long, char> edges;
+  for (unsigned int k = 0; k < cells.size(); k++) {
+    int i = cells[k] / cols, j = cells[k] % cols;
+    long long sw = (long long)i*(cols+1) + j;
+    long long se = sw + 1, ne = sw + cols + 2, nw = sw + cols + 1;
+    if (i == 0 || building_id[i-1][j] != label) edges[sw*4 + 0] = 1;
+    if (j == cols-1 || building_id[i][j+1] != label) edges[se*4 + 1] = 1;
+    if (i == rows-1 || building_id[i+1][j] != label) edges[ne*4 + 2] = 1;
+    if (j == 0 || building_id[i][j-1] != label) edges[nw*4 + 3] = 1;
+  }
+
+  vector<float> best;
+  double best_area = 0;
+  while (edges.size() > 0) {
+    long long e = edges.begin()->first;
+    vector<float> loop;
+    int d = e % 4, last_d = -1, first_d = d;
+    long long v = e / 4, start_v = v;
+    while (1) {
+      edges.erase(v*4 + d);
+      if (d != last_d) {
+	loop.push_back(v / (cols+1));
+	loop.push_back(v % (cols+1));
+      }
+      last_d = d;
+      v += (long long)DI[d]*(cols+1) + DJ[d];
+      if (v == start_v) break;
+      //turn right, go straight or turn left
+      int next = -1;
+      int turns[3] = {(d+3) % 4, d, (d+1) % 4};
+      for (int t = 0; t < 3 && next < 0; t++) {
+	if (edges.count(v*4 + turns[t])) next = turns[t];
+      }
+      if (next < 0) break;
+      d = next;
+    }
+    //the start is a corner only if the loop turns there
+    if (last_d == first_d && loop.size() > 2) loop.erase(loop.begin(), loop.begin() + 2);
+
+    //shoelace; counterclockwise in (col, row) = (x, y) is positive
+    double area = 0;
+    int n = loop.size()/2;
+    for (int k = 0; k < n; k++) {
+      int k1 = (k + 1) % n;
+      area += loop[2*k+1]*loop[2*k1] - loop[2*k1+1]*loop[2*k];
+    }
+    if (area/2 > best_area) {
+      best_area = area/2;
+      best.swap(loop);
+    }
+  }
+  return best;
+}
+
+
+//the footprint of the ring pts (row, col) in map coordinates,
+//simplified, or as is if simplifying leaves less than a triangle
+vector<float> simplify_footprint(const vector<float>& ring) {
+  int n = ring.size()/2;
+  if (n < 3) return vector<float>();
+  //as an open polyline from corner 0 around back to corner 0, in map
+  //coordinates
+  vector<float> pts;
+  for (int k = 0; k <= n; k++) {
+    pts.push_back(minx + ring[2*(k % n)+1]*cell_size);
+    pts.push_back(miny + ring[2*(k % n)]*cell_size);
+  }
+  vector<unsigned char> keep(n+1, 0);
+  keep[0] = keep[n] = 1;
+  //split at the corner farthest from corner 0, so both halves are
+  //open polylines with distinct ends
+  int far_k = 0;
+  float far = 0;
+  for (int k = 1; k < n; k++) {
+    float dx = pts[2*k] - pts[0], dy = pts[2*k+1] - pts[1];
+    if (dx*dx + dy*dy > far) {
+      far = dx*dx + dy*dy;
+      far_k = k;
+    }
+  }
+  keep[far_k] = 1;
+  float tol = FOOTPRINT_TOLERANCE*cell_size;
+  simplify_polyline(pts, 0, far_k, tol, keep);
+  simplify_polyline(pts, far_k, n, tol, keep);
+
+  vector<float> out;
+  for (int k = 0; k < n; k++) {
+    if (!keep[k]) continue;
+    out.push_back(pts[2*k]);
+    out.push_back(pts[2*k+1]);
+  }
+  //e.g. a building one cell wide collapses to a segment
+  if (out.size() < 6) out.assign(pts.begin(), pts.end() - 2);
+  return out;
+}
+
+
+//label the building cells of is_ground and compute buildings
+void extract_buildings() {
+  int rows = is_ground.size();
+  int cols = is_ground[0].size();
+  double start = omp_get_wtime();
+
+  //union-find over the building cells, by bands of rows
+  vector<int> parent(rows*cols);
+  int nbands = (rows + BUILDING_BAND - 1)/BUILDING_BAND;
+#pragma omp parallel for schedule(dynamic, 1)
+  for (int b = 0; b < nbands; b++) {
+    int i0 = b*BUILDING_BAND, i1 = min(rows, i0 + BUILDING_BAND);
+    for (int i = i0; i < i1; i++) {
+      for (int j = 0; j < cols; j++) {
+	int c = i*cols + j;
+	parent[c] = c;
+	if (is_ground[i][j] != 0) continue;
+	if (j > 0 && is_ground[i][j-1] == 0) uf_union(parent, c, c - 1);
+	if (i > i0 && is_ground[i-1][j] == 0) uf_union(parent, c, c - cols);
+      }
+    }
+  }
+  //the seams
+  for (int b = 1; b < nbands; b++) {
+    int i = b*BUILDING_BAND;
+    for (int j = 0; j < cols; j++) {
+      if (is_ground[i][j] == 0 && is_ground[i-1][j] == 0) {
+	uf_union(parent, i*cols + j, (i-1)*cols + j);
+      }
+    }
+  }
+  //a parent always has a smaller index than its child, so in index
+  //order the parent of a cell already points to its root
+  for (int c = 0; c < rows*cols; c++) {
+    parent[c] = parent[parent[c]];
+  }
+
+  //one index per large enough component, in the order of their roots
+  vector<int> size(rows*cols, 0);
+  for (int c = 0; c < rows*cols; c++) {
+    if (is_ground[c / cols][c % cols] == 0) size[parent[c]]++;
+  }
+  int min_cells = ceil(BUILDING_MIN_AREA/(cell_size*cell_size));
+  vector<int> index(rows*cols, -1);
+  int nb = 0;
+  for (int c = 0; c < rows*cols; c++) {
+    if (size[c] > 0 && size[c] >= min_cells) index[c] = nb++;
+  }
+
+  //the cells of each building, contiguous (counting sort)
+  building_id.assign(rows, vector<int>(cols, 0));
+  vector<int> start_of(nb + 1, 0);
+  for (int c = 0; c < rows*cols; c++) {
+    if (is_ground[c / cols][c % cols] != 0) continue;
+    int b = index[parent[c]];
+    if (b < 0) continue;
+    building_id[c / cols][c % cols] = b + 1;
+    start_of[b+1]++;
+  }
+  for (int b = 0; b < nb; b++) start_of[b+1] += start_of[b];
+  vector<int> cells(start_of[nb]);
+  vector<int> fill_at(start_of.begin(), start_of.end() - 1);
+  for (int c = 0; c < rows*cols; c++) {
+    int b = building_id[c / cols][c % cols] - 1;
+    if (b >= 0) cells[fill_at[b]++] = c;
+  }
+
+  vector<vector<float> > ground;
+  ground_surface(ground);
+
+  buildings.assign(nb, building());
+#pragma omp parallel for schedule(dynamic, 4)
+  for (int b = 0; b < nb; b++) {
+    building& bd = buildings[b];
+    vector<int> mine(cells.begin() + start_of[b], cells.begin() + start_of[b+1]);
+    bd.cells = mine.size();
+    bd.area = bd.cells*cell_size*cell_size;
+    bd.max_height = 0;
+    double height = 0, roof = 0;
+    //the roof slope over the interior cells, away from the walls, or
+    //over all the cells of a building too narrow to have any
+    double slope = 0, slope_interior = 0;
+    int interior_cells = 0;
+    for (int k = 0; k < bd.cells; k++) {
+      int i = mine[k] / cols, j = mine[k] % cols;
+      float h = (ground[i][j] == NODATA) ? 0 : last_grid[i][j] - ground[i][j];
+      bd.max_height = max(bd.max_height, h);
+      height += h;
+      roof += last_grid[i][j];
+      int interior;
+      float s = roof_cell_slope(i, j, b + 1, &interior);
+      slope += s;
+      if (interior) {
+	slope_interior += s;
+	interior_cells++;
+      }
+    }
+    bd.mean_height = height/bd.cells;
+    bd.roof_slope = interior_cells ? slope_interior/interior_cells : slope/bd.cells;
+    bd.roof_z = roof/bd.cells;
+    bd.footprint = simplify_footprint(trace_footprint(mine, b + 1));
+  }
+
+  float largest = 0;
+  for (int b = 0; b < nb; b++) largest = max(largest, buildings[b].area);
+  printf("buildings: %d, largest %.0f m^2, in %.2fs\n", nb, largest,
+	 omp_get_wtime() - start);
+}
+
+
+//write the footprints to fname as GeoJSON polygons, with their
+//statistics
+void write_buildings(const char* fname) {
+  FILE* f = fopen(fname, "w");
+  if (!f) {
+    printf("cannot write %s\n", fname);
+    return;
+  }
+  fprintf(f, "{\"type\": \"FeatureCollection\", \"features\": [\n");
+  for (unsigned int b = 0; b < buildings.size(); b++) {
+    building& bd = buildings[b];
+    fprintf(f, "{\"type\": \"Feature\", \"properties\": {\"id\": %d, "
+	    "\"area\": %.1f, \"max_height\": %.2f, \"mean_height\": %.2f, "
+	    "\"roof_slope\": %.1f}, ", b + 1, bd.area, bd.max_height,
+	    bd.mean_height, bd.roof_slope);
+    int n = bd.footprint.size()/2;
+    if (n < 3) {
+      fprintf(f, "\"geometry\": null}%s\n", b + 1 < buildings.size() ? "," : "");
+      continue;
+    }
+    fprintf(f, "\"geometry\": {\"type\": \"Polygon\", \"coordinates\": [[");
+    //GeoJSON rings repeat their first point
+    for (int k = 0; k <= n; k++) {
+      fprintf(f, "%s[%.3f, %.3f]", k ? ", " : "",
+	      bd.footprint[2*(k % n)], bd.footprint[2*(k % n)+1]);
+    }
+    fprintf(f, "]]}}%s\n", b + 1 < buildings.size() ? "," : "");
+  }
+  fprintf(f, "]}\n");
+  fclose(f);
+  printf("wrote %s\n", fname);
+}
+
+
+
+/* ************************************************************ */
+/* ROOF PLANES */
+/* The planes of each roof, found with sequential RANSAC over the
+   points of the building that are at least ROOF_MIN_HEIGHT above the
+   ground: the best plane of the remaining points is found, refitted
+   to its inliers by least squares (the normal is the eigenvector of
+   the smallest eigenvalue of their covariance, see POINT FEATURES),
+   and its inliers are removed; until too few points are left.
+
+   The hypotheses (planes through 3 random points) come in batches of
+   ROOF_BATCH, scored together in one pass over the points, with the
+   points in the outer loop and the hypotheses in an inner loop the
+   compiler can vectorize. Only the first ROOF_SAMPLE of the remaining
+   points, which are kept in random order, take part in the scoring;
+   the full set is used for the refit. The search stops early once enough batches
+   have been tried to find the best plane with 99% probability given
+   the best inlier ratio seen so far:
+
+     iterations = log(1 - 0.99) / log(1 - w^3)
+
+   The buildings are independent and are handed out to the threads
+   one at a time as they finish (dynamic schedule); each building has
+   its own random sequence, so the result doesn't depend on the
+   number of threads.
+*/
+#define ROOF_BATCH 16
+#define ROOF_MAX_ITERATIONS 1024
+#define ROOF_MAX_PLANES 20
+#define ROOF_MIN_HEIGHT 1.0
+#define ROOF_SAMPLE 4096
+
+//the roof planes of building b through the points pts (indices into
+//points), appended to planes
+void building_planes(int b, vector<int>& pts, vector<roofPlane>& planes) {
+  int n = pts.size();
+  if (n < ROOF_MIN_POINTS) return;
+
+  //relative to the centroid, for the precision of the floats
+  double ox = 0, oy = 0, oz = 0;
+  for (int k = 0; k < n; k++) {
+    ox += points[pts[k]].x;
+    oy += points[pts[k]].y;
+    oz += points[pts[k]].z;
+  }
+  ox /= n; oy /= n; oz /= n;
+  vector<float> px(n), py(n), pz(n);
+  for (int k = 0; k < n; k++) {
+    px[k] = points[pts[k]].x - ox;
+    py[k] = points[pts[k]].y - oy;
+    pz[k] = points[pts[k]].z - oz;
+  }
+
+  unsigned short seed[3] = {0x1234, (unsigned short)b, (unsigned short)(b >> 16)};
+  vector<int> remaining(n);
+  for (int k = 0; k < n; k++) remaining[k] = k;
+  for (int k = n - 1; k > 0; k--) {
+    swap(remaining[k], remaining[(int)(erand48(seed)*(k + 1))]);
+  }
+  vector<int> count(ROOF_BATCH);
+
+  while ((int)remaining.size() >= ROOF_MIN_POINTS &&
+	 (int)planes.size() < ROOF_MAX_PLANES) {
+    int m = remaining.size();
+    int sample = min(m, ROOF_SAMPLE);
+    float best[4] = {0, 0, 1, 0};
+    int best_count = 0;
+    int needed = ROOF_MAX_ITERATIONS;
+
+    for (int it = 0; it < needed; it += ROOF_BATCH) {
+      //a batch of hypotheses, nx ny nz d
+      float h[4][ROOF_BATCH];
+      for (int q = 0; q < ROOF_BATCH; q++) {
+	int i0 = remaining[(int)(erand48(seed)*m)];
+	int i1 = remaining[(int)(erand48(seed)*m)];
+	int i2 = remaining[(int)(erand48(seed)*m)];
+	float ux = px[i1] - px[i0], uy = py[i1] - py[i0], uz = pz[i1] - pz[i0];
+	float vx = px[i2] - px[i0], vy = py[i2] - py[i0], vz = pz[i2] - pz[i0];
+	float nx = uy*vz - uz*vy, ny = uz*vx - ux*vz, nz = ux*vy - uy*vx;
+	float len = sqrt(nx*nx + ny*ny + nz*nz);
+	if (len < 1e-6) {
+	  //degenerate; a plane nothing is near
+	  h[0][q] = h[1][q] = h[2][q] = 0;
+	  h[3][q] = BIGINT;
+	  continue;
+	}
+	h[0][q] = nx/len;
+	h[1][q] = ny/len;
+	h[2][q] = nz/len;
+	h[3][q] = -(h[0][q]*px[i0] + h[1][q]*py[i0] + h[2][q]*pz[i0]);
+      }
+
+      //score the batch in one pass over the points
+      fill(count.begin(), count.end(), 0);
+      for (int k = 0; k < sample; k++) {
+	int p = remaining[k];
+	float x = px[p], y = py[p], z = pz[p];
+#pragma omp simd
+	for (int q = 0; q < ROOF_BATCH; q++) {
+	  float d = h[0][q]*x + h[1][q]*y + h[2][q]*z + h[3][q];
+	  count[q] += fabsf(d) < ROOF_PLANE_DIST;
+	}
+      }
+
+      for (int q = 0; q < ROOF_BATCH; q++) {
+	if (count[q] > best_count) {
+	  best_count = count[q];
+	  for (int k = 0; k < 4; k++) best[k] = h[k][q];
+	}
+      }
+      //early termination
+      float w = float(best_count)/sample;
+      if (w >= 1) break;
+      if (w > 0) {
+	double iters = log(1 - 0.99)/log(1 - (double)w*w*w);
+	needed = min((double)ROOF_MAX_ITERATIONS, iters);
+      }
+    }
+    if ((long)best_count*m < (long)ROOF_MIN_POINTS*sample) break;
+
+    //least squares refit on the inliers, then the inliers of the refit
+    vector<int> in;
+    for (int k = 0; k < m; k++) {
+      int p = remaining[k];
+      float d = best[0]*px[p] + best[1]*py[p] + best[2]*pz[p] + best[3];
+      if (fabsf(d) < ROOF_PLANE_DIST) in.push_back(p);
+    }
+    double mx = 0, my = 0, mz = 0;
+    for (unsigned int k = 0; k < in.size(); k++) {
+      mx += px[in[k]]; my += py[in[k]]; mz += pz[in[k]];
+    }
+    mx /= in.size(); my /= in.size(); mz /= in.size();
+    float cov[6] = {0, 0, 0, 0, 0, 0};
+    for (unsigned int k = 0; k < in.size(); k++) {
+      float x = px[in[k]] - mx, y = py[in[k]] - my, z = pz[in[k]] - mz;
+      cov[0] += x*x; cov[1] += x*y; cov[2] += x*z;
+      cov[3] += y*y; cov[4] += y*z; cov[5] += z*z;
+    }
+    float e1, e2, e3, nx, ny, nz;
+    eigen3_block(1, &cov[0], &cov[1], &cov[2], &cov[3], &cov[4], &cov[5],
+		 &e1, &e2, &e3, &nx, &ny, &nz);
+    float d0 = -(nx*mx + ny*my + nz*mz);
+
+    roofPlane rp;
+    rp.building = b;
+    rp.nx = nx; rp.ny = ny; rp.nz = nz;
+    rp.cx = mx + ox; rp.cy = my + oy; rp.cz = mz + oz;
+    rp.slope = acos(fminf(nz, 1.0f))*180/M_PI;
+    float a = atan2(nx, ny)*180/M_PI;
+    rp.aspect = (a < 0) ? a + 360 : a;
+    double sq = 0;
+    vector<int> rest;
+    for (int k = 0; k < m; k++) {
+      int p = remaining[k];
+      float d = nx*px[p] + ny*py[p] + nz*pz[p] + d0;
+      if (fabsf(d) < ROOF_PLANE_DIST) {
+	rp.inliers.push_back(pts[p]);
+	sq += d*d;
+      } else {
+	rest.push_back(p);
+      }
+    }
+    if ((int)rp.inliers.size() < ROOF_MIN_POINTS) break;
+    rp.rmse = sqrt(sq/rp.inliers.size());
+    planes.push_back(rp);
+    remaining.swap(rest);
+  }
+}
+
+
+//compute roof_planes for all the buildings
+void compute_roof_planes() {
+  int rows = building_id.size();
+  int cols = building_id[0].size();
+  int nb = buildings.size();
+  double start = omp_get_wtime();
+  vector<vector<float> > ground;
+  ground_surface(ground);
+
+  //the cells of each building
+  vector<vector<int> > cells(nb);
+  for (int i = 0; i < rows; i++) {
+    for (int j = 0; j < cols; j++) {
+      if (building_id[i][j] > 0) cells[building_id[i][j] - 1].push_back(i*cols + j);
+    }
+  }
+
+  vector<vector<roofPlane> > found(nb);
+  long roof_points = 0;
+#pragma omp parallel for schedule(dynamic, 1) reduction(+:roof_points)
+  for (int b = 0; b < nb; b++) {
+    vector<int> pts;
+    for (unsigned int k = 0; k < cells[b].size(); k++) {
+      int c = cells[b][k];
+      float g = ground[c / cols][c % cols];
+      for (int m = cell_start[c]; m < cell_start[c+1]; m++) {
+	int p = cell_points[m];
+	if (g == NODATA || points[p].z > g + ROOF_MIN_HEIGHT) pts.push_back(p);
+      }
+    }
+    roof_points += pts.size();
+    building_planes(b, pts, found[b]);
+  }
+
+  //the roof slope of a building with planes is their mean, weighted
+  //by their inliers
+  roof_planes.clear();
+  long inliers = 0;
+  for (int b = 0; b < nb; b++) {
+    double slope = 0;
+    long n = 0;
+    for (unsigned int k = 0; k < found[b].size(); k++) {
+      slope += found[b][k].slope*found[b][k].inliers.size();
+      n += found[b][k].inliers.size();
+      roof_planes.push_back(roofPlane());
+      swap(roof_planes.back(), found[b][k]);
+    }
+    if (n > 0) buildings[b].roof_slope = slope/n;
+    inliers += n;
+  }
+  printf("roof planes: %d in %d buildings, %.1f%% of the roof points, in %.2fs\n",
+	 (int)roof_planes.size(), nb, 100.0*inliers/max(roof_points, 1L),
+	 omp_get_wtime() - start);
+}
+
+
+//write the roof planes to <prefix>_roofplanes.txt, one per line, and
+//their inliers to <prefix>_roofpoints.txt, as x y z plane
+void write_roof_planes(const char* prefix) {
+  string fname = string(prefix) + "_roofplanes.txt";
+  FILE* f = fopen(fname.c_str(), "w");
+  if (!f) {
+    printf("cannot write %s\n", fname.c_str());
+    return;
+  }
+  fprintf(f, "plane building nx ny nz cx cy cz slope aspect rmse inliers\n");
+  for (unsigned int k = 0; k < roof_planes.size(); k++) {
+    roofPlane& rp = roof_planes[k];
+    fprintf(f, "%d %d %.4f %.4f %.4f %.3f %.3f %.3f %.1f %.1f %.3f %d\n",
+	    k, rp.building + 1, rp.nx, rp.ny, rp.nz, rp.cx, rp.cy, rp.cz,
+	    rp.slope, rp.aspect, rp.rmse, (int)rp.inliers.size());
+  }
+  fclose(f);
+  printf("wrote %s\n", fname.c_str());
+
+  fname = string(prefix) + "_roofpoints.txt";
+  f = fopen(fname.c_str(), "w");
+  if (!f) {
+    printf("cannot write %s\n", fname.c_str());
+    return;
+  }
+  for (unsigned int k = 0; k < roof_planes.size(); k++) {
+    vector<int>& in = roof_planes[k].inliers;
+    for (unsigned int m = 0; m < in.size(); m++) {
+      fprintf(f, "%.3f %.3f %.3f %d\n", points[in[m]].x, points[in[m]].y,
+	      points[in[m]].z, k);
+    }
+  }
+  fclose(f);
+  printf("wrote %s\n", fname.c_str());
+}
+
+
+
+/* ************************************************************ */
+/* HYDROLOGY */
+/* Drainage of the bare earth, in three steps:
+
+   1. The ground, from ground_surface() (see CANOPY HEIGHT).
+
+   2. Depression filling with Priority-Flood+epsilon (Barnes et al.):
+      the flood starts from the border of the grid and always grows
+      from its lowest cell, taken from a priority queue. A neighbour
+      that is not higher is in a depression; it is raised to just
+      above the cell (nextafter) and goes into a plain FIFO queue,
+      which is served first. The cells of depressions and flats thus
+      cost O(1) each and only the others pay O(log n). Every cell
+      ends up with a strictly lower neighbour or on the border.
+
+   3. D8 directions (steepest descent over the 8 neighbours, the
+      diagonals at distance sqrt(2)), in parallel over the rows; then
+      flow accumulation in topological order (Kahn): the cells that
+      nobody drains into go first, and a cell is pushed when all the
+      cells upstream of it are done. O(n).
+*/
+
+//the 8 neighbours as (row, col) offsets, rows run north, and their
+//ESRI D8 codes
+const int D8_DI[8] = {0, -1, -1, -1, 0, 1, 1, 1};
+const int D8_DJ[8] = {1, 1, 0, -1, -1, -1, 0, 1};
+const int D8_CODE[8] = {1, 2, 4, 8, 16, 32, 64, 128};
+
+typedef pair<float, int> floodCell; //elevation, i*cols+j
+
+//fill the depressions of dem (rows x cols, flat) in place; returns
+//the number of cells raised
+int priority_flood(vector<float>& dem, int rows, int cols) {
+  priority_queue<floodCell, vector<floodCell>, greater<floodCell> > open;
+  queue<int> pit;
+  vector<unsigned char> closed(rows*cols, 0);
+
+  //the border cells drain off the grid
+  for (int i = 0; i < rows; i++) {
+    for (int j = 0; j < cols; j++) {
+      if (i == 0 || j == 0 || i == rows - 1 || j == cols - 1) {
+	open.push(floodCell(dem[i*cols + j], i*cols + j));
+	closed[i*cols + j] = 1;
+      }
+    }
+  }
+
+  int raised = 0;
+  while (!open.empty() || !pit.empty()) {
+    int c;
+    if (!pit.empty()) {
+      c = pit.front();
+      pit.pop();
+    } else {
+      c = open.top().second;
+      open.pop();
+    }
+    int i = c / cols, j = c % cols;
+    float above = nextafterf(dem[c], BIGINT);
+
+    for (int k = 0; k < 8; k++) {
+      int ni = i + D8_DI[k], nj = j + D8_DJ[k];
+      if (ni < 0 || ni >= rows || nj < 0 || nj >= cols) continue;
+      int n = ni*cols + nj;
+      if (closed[n]) continue;
+      closed[n] = 1;
+      if (dem[n] <= above) {
+	if (dem[n] < above) raised++;
+	dem[n] = above;
+	pit.push(n);
+      } else {
+	open.push(floodCell(dem[n], n));
+      }
+    }
+  }
+  return raised;
+}
+
+
+//D8 direction of every cell of dem, as an index into D8_DI/DJ, -1 if
+//no neighbour is lower
+void d8_directions(const vector<float>& dem, int rows, int cols,
+		   vector<signed char>& dir) {
+  dir.resize(rows*cols);
+#pragma omp parallel for schedule(static)
+  for (int i = 0; i < rows; i++) {
+    for (int j = 0; j < cols; j++) {
+      int c = i*cols + j;
+      float best = 0;
+      int best_k = -1;
+      for (int k = 0; k < 8; k++) {
+	int ni = i + D8_DI[k], nj = j + D8_DJ[k];
+	if (ni < 0 || ni >= rows || nj < 0 || nj >= cols) continue;
+	float drop = dem[c] - dem[ni*cols + nj];
+	if (k & 1) drop *= M_SQRT1_2; //diagonal
+	if (drop > best) {
+	  best = drop;
+	  best_k = k;
+	}
+      }
+      dir[c] = best_k;
+    }
+  }
+}
+
+
+//number of cells draining through each cell, following dir
+void flow_accumulation(const vector<signed char>& dir, int rows, int cols,
+		       vector<float>& acc) {
+  int n = rows*cols;
+  vector<int> receiver(n, -1);
+  vector<unsigned char> upstream(n, 0); //at most 8 neighbours drain in
+#pragma omp parallel for schedule(static)
+  for (int c = 0; c < n; c++) {
+    if (dir[c] < 0) continue;
+    int r = (c / cols + D8_DI[(int)dir[c]])*cols + c % cols + D8_DJ[(int)dir[c]];
+    receiver[c] = r;
+#pragma omp atomic
+    upstream[r]++;
+  }
+
+  acc.assign(n, 1);
+  vector<int> ready;
+  for (int c = 0; c < n; c++) {
+    if (upstream[c] == 0) ready.push_back(c);
+  }
+  while (ready.size() > 0) {
+    int c = ready.back();
+    ready.pop_back();
+    int r = receiver[c];
+    if (r < 0) continue;
+    acc[r] += acc[c];
+    if (--upstream[r] == 0) ready.push_back(r);
+  }
+}
+
+
+//compute filled_dem, flow_dir and flow_acc from the ground
+void compute_flow() {
+  int rows = last_grid.size();
+  int cols = last_grid[0].size();
+  double start = omp_get_wtime();
+
+  //the ground, with the rest interpolated
+  ground_surface(filled_dem);
+
+  vector<float> dem(rows*cols);
+  for (int i = 0; i < rows; i++) {
+    for (int j = 0; j < cols; j++) {
+      //only if there is no ground at all
+      dem[i*cols + j] = (filled_dem[i][j] == NODATA) ? 0 : filled_dem[i][j];
+    }
+  }
+
+  int raised = priority_flood(dem, rows, cols);
+  vector<signed char> dir;
+  d8_directions(dem, rows, cols, dir);
+  vector<float> acc;
+  flow_accumulation(dir, rows, cols, acc);
+
+  flow_dir.assign(rows, vector<float>(cols));
+  flow_acc.assign(rows, vector<float>(cols));
+  float largest = 0;
+  for (int i = 0; i < rows; i++) {
+    for (int j = 0; j < cols; j++) {
+      int c = i*cols + j;
+      filled_dem[i][j] = dem[c];
+      flow_dir[i][j] = (dir[c] < 0) ? 0 : D8_CODE[(int)dir[c]];
+      flow_acc[i][j] = acc[c];
+      if (dir[c] < 0 && acc[c] > largest) largest = acc[c];
+    }
+  }
+  printf("flow: %d cells raised to drain depressions and flats, largest catchment %.0f cells, in %.2fs\n",
+	 raised, largest, omp_get_wtime() - start);
+}
+
+
+
+/* ************************************************************ */
+/* CONTOURS */
+/* Marching squares over elevation. The squares join the centres of
+   four cells; a square with a NODATA corner has no contours, so the
+   lines stop at the holes. Each square gives its segments for all the
+   levels between its lowest and highest corner at once, so all the
+   levels (and all the intervals) are one pass over the grid. Saddles
+   are decided by the average of the four corners.
+
+   Every end of a segment lies on a grid edge, and the crossing of a
+   level and an edge is computed the same way by both squares that
+   share the edge. So the segments are stitched into polylines by
+   matching (level, edge) keys, with no geometric tolerance.
+
+   The grid is cut into bands of rows that are contoured and stitched
+   in parallel. The polylines that end on the seam between two bands
+   share its keys, and a second stitch over all the bands joins them.
+*/
+#define CONTOUR_BAND 64 //rows of squares per band
+
+//key of the crossing of level index l and grid edge e
+inline long long contour_key(int l, int e, int rows, int cols) {
+  return (long long)l*2*rows*cols + e;
+}
+
+//the point where level crosses the edge from cell (i,j) to cell
+//(i+di, j+dj), in grid coordinates; always interpolated from (i,j)
+void edge_crossing(int i, int j, int di, int dj, float level, float* p) {
+  float a = elevation[i][j], b = elevation[i+di][j+dj];
+  float t = (level - a)/(b - a);
+  p[0] = i + t*di;
+  p[1] = j + t*dj;
+}
+
+//the piece that continues a line at key, other than the used ones;
+//-1 if none
+int next_contour_piece(unordered_map<long long, vector<int> >& at,
+		       long long key, const vector<unsigned char>& used) {
+  unordered_map<long long, vector<int> >::iterator it = at.find(key);
+  if (it == at.end()) return -1;
+  for (unsigned int k = 0; k < it->second.size(); k++) {
+    if (!used[it->second[k]]) return it->second[k];
+  }
+  return -1;
+}
+
+//join the pieces that share end keys into polylines
+vector<contourLine> stitch_contours(vector<contourLine>& pieces) {
+  unordered_map<long long, vector<int> > at;
+  for (unsigned int p = 0; p < pieces.size(); p++) {
+    if (pieces[p].closed) continue;
+    at[pieces[p].key0].push_back(p);
+    at[pieces[p].key1].push_back(p);
+  }
+
+  vector<contourLine> lines;
+  vector<unsigned char> used(pieces.size(), 0);
+  for (unsigned int p = 0; p < pieces.size(); p++) {
+    if (used[p]) continue;
+    used[p] = 1;
+    contourLine line;
+    line.level = pieces[p].level;
+    line.major = pieces[p].major;
+    line.closed = pieces[p].closed;
+    line.key0 = pieces[p].key0;
+    line.key1 = pieces[p].key1;
+    line.pts.swap(pieces[p].pts);
+    if (line.closed) {
+      lines.push_back(line);
+      continue;
+    }
+
+    //forward from key1; the shared point is not repeated
+    int q;
+    while ((q = next_contour_piece(at, line.key1, used)) >= 0) {
+      used[q] = 1;
+      vector<float>& pts = pieces[q].pts;
+      int n = pts.size()/2;
+      if (pieces[q].key0 == line.key1) {
+	line.pts.insert(line.pts.end(), pts.begin() + 2, pts.end());
+	line.key1 = pieces[q].key1;
+      } else {
+	for (int k = n - 2; k >= 0; k--) {
+	  line.pts.push_back(pts[2*k]);
+	  line.pts.push_back(pts[2*k+1]);
+	}
+	line.key1 = pieces[q].key0;
+      }
+    }
+    if (line.key1 == line.key0) {
+      line.closed = 1;
+      lines.push_back(line);
+      continue;
+    }
+
+    //backward from key0, collected going away from the start
+    vector<float> back;
+    while ((q = next_contour_piece(at, line.key0, used)) >= 0) {
+      used[q] = 1;
+      vector<float>& pts = pieces[q].pts;
+      int n = pts.size()/2;
+      if (pieces[q].key1 == line.key0) {
+	for (int k = n - 2; k >= 0; k--) {
+	  back.push_back(pts[2*k]);
+	  back.push_back(pts[2*k+1]);
+	}
+	line.key0 = pieces[q].key0;
+      } else {
+	back.insert(back.end(), pts.begin() + 2, pts.end());
+	line.key0 = pieces[q].key1;
+      }
+    }
+    if (back.size() > 0) {
+      vector<float> pts;
+      pts.reserve(back.size() + line.pts.size());
+      for (int k = back.size()/2 - 1; k >= 0; k--) {
+	pts.push_back(back[2*k]);
+	pts.push_back(back[2*k+1]);
+      }
+      pts.insert(pts.end(), line.pts.begin(), line.pts.end());
+      line.pts.swap(pts);
+    }
+    lines.push_back(line);
+  }
+  return lines;
+}
+
+
+//the segments of the squares with lower left corner in rows
+//[i0, i1), for levels (sorted)
+void contour_band(int i0, int i1, const vector<float>& levels,
+		  const vector<int>& major, vector<contourLine>& segs) {
+  int rows = elevation.size();
+  int cols = elevation[0].size();
+  for (int i = i0; i < i1; i++) {
+    for (int j = 0; j < cols - 1; j++) {
+      //corners counterclockwise from the lower left
+      float v[4] = {elevation[i][j], elevation[i][j+1],
+		    elevation[i+1][j+1], elevation[i+1][j]};
+      if (v[0] == NODATA || v[1] == NODATA ||
+	  v[2] == NODATA || v[3] == NODATA) continue;
+      float lo = min(min(v[0], v[1]), min(v[2], v[3]));
+      float hi = max(max(v[0], v[1]), max(v[2], v[3]));
+
+      //the levels in (lo, hi]
+      int l0 = upper_bound(levels.begin(), levels.end(), lo) - levels.begin();
+      int l1 = upper_bound(levels.begin(), levels.end(), hi) - levels.begin();
+      for (int l = l0; l < l1; l++) {
+	float level = levels[l];
+	int idx = 0;
+	for (int k = 0; k < 4; k++) {
+	  if (v[k] >= level) idx |= 1 << k;
+	}
+
+	//edges bottom, right, top, left: their keys and crossings
+	int e[4] = {2*(i*cols + j), 2*(i*cols + j+1) + 1,
+		    2*((i+1)*cols + j), 2*(i*cols + j) + 1};
+	float p[4][2];
+	int crossed[4], nc = 0;
+	if ((idx ^ (idx >> 1)) & 1) {
+	  edge_crossing(i, j, 0, 1, level, p[0]);
+	  crossed[nc++] = 0;
+	}
+	if (((idx >> 1) ^ (idx >> 2)) & 1) {
+	  edge_crossing(i, j+1, 1, 0, level, p[1]);
+	  crossed[nc++] = 1;
+	}
+	if (((idx >> 2) ^ (idx >> 3)) & 1) {
+	  edge_crossing(i+1, j, 0, 1, level, p[2]);
+	  crossed[nc++] = 2;
+	}
+	if (((idx >> 3) ^ idx) & 1) {
+	  edge_crossing(i, j, 1, 0, level, p[3]);
+	  crossed[nc++] = 3;
+	}
+
+	//pairs of crossed edges to join
+	int pairs[2][2], np = 0;
+	if (nc == 2) {
+	  pairs[0][0] = crossed[0];
+	  pairs[0][1] = crossed[1];
+	  np = 1;
+	} else {
+	  //saddle: cut off the two corners on the other side of the
+	  //centre from the level
+	  int centre_above = (v[0] + v[1] + v[2] + v[3])/4 >= level;
+	  int corner0_above = idx & 1;
+	  if (corner0_above == centre_above) {
+	    //cut off corners 1 and 3
+	    pairs[0][0] = 0; pairs[0][1] = 1;
+	    pairs[1][0] = 2; pairs[1][1] = 3;
+	  } else {
+	    //cut off corners 0 and 2
+	    pairs[0][0] = 3; pairs[0][1] = 0;
+	    pairs[1][0] = 1; pairs[1][1] = 2;
+	  }
+	  np = 2;
+	}
+
+	for (int k = 0; k < np; k++) {
+	  contourLine seg;
+	  seg.level = level;
+	  seg.major = major[l];
+	  seg.closed = 0;
+	  int a = pairs[k][0], b = pairs[k][1];
+	  seg.key0 = contour_key(l, e[a], rows, cols);
+	  seg.key1 = contour_key(l, e[b], rows, cols);
+	  seg.pts.push_back(p[a][0]);
+	  seg.pts.push_back(p[a][1]);
+	  seg.pts.push_back(p[b][0]);
+	  seg.pts.push_back(p[b][1]);
+	  segs.push_back(seg);
+	}
+      }
+    }
+  }
+}
+
+
+//compute contours of elevation at the multiples of contour_intervals
+void compute_contours() {
+  int rows = elevation.size();
+  double start = omp_get_wtime();
+
+  //the levels, and which are multiples of the largest interval
+  float lo = BIGINT, hi = -BIGINT;
+  for (int i = 0; i < rows; i++) {
+    for (unsigned int j = 0; j < elevation[i].size(); j++) {
+      if (elevation[i][j] == NODATA) continue;
+      lo = min(lo, elevation[i][j]);
+      hi = max(hi, elevation[i][j]);
+    }
+  }
+  float largest = *max_element(contour_intervals.begin(),
+			       contour_intervals.end());
+  vector<float> levels;
+  for (unsigned int k = 0; k < contour_intervals.size(); k++) {
+    float step = contour_intervals[k];
+    for (long m = ceil(lo/step); m*step <= hi; m++) levels.push_back(m*step);
+  }
+  sort(levels.begin(), levels.end());
+  vector<float> unique_levels;
+  vector<int> major;
+  for (unsigned int k = 0; k < levels.size(); k++) {
+    if (unique_levels.size() > 0 &&
+	levels[k] - unique_levels.back() < 1e-4*largest) continue;
+    unique_levels.push_back(levels[k]);
+    float m = levels[k]/largest;
+    major.push_back(fabs(m - floor(m + 0.5)) < 1e-4);
+  }
+
+  //contour and stitch each band, then join the bands
+  int nbands = (rows - 1 + CONTOUR_BAND - 1)/CONTOUR_BAND;
+  vector<vector<contourLine> > band(nbands);
+#pragma omp parallel for schedule(dynamic, 1)
+  for (int b = 0; b < nbands; b++) {
+    vector<contourLine> segs;
+    contour_band(b*CONTOUR_BAND, min((b+1)*CONTOUR_BAND, rows - 1),
+		 unique_levels, major, segs);
+    band[b] = stitch_contours(segs);
+  }
+  vector<contourLine> pieces;
+  for (int b = 0; b < nbands; b++) {
+    for (unsigned int k = 0; k < band[b].size(); k++) {
+      pieces.push_back(contourLine());
+      swap(pieces.back(), band[b][k]);
+    }
+  }
+  contours = stitch_contours(pieces);
+
+  long npts = 0;
+  for (unsigned int k = 0; k < contours.size(); k++) {
+    npts += contours[k].pts.size()/2;
+  }
+  printf("contours: %d levels, %d lines, %ld points, in %.2fs\n",
+	 (int)unique_levels.size(), (int)contours.size(), npts,
+	 omp_get_wtime() - start);
+}
+
+
+//write the contours to fname as GeoJSON line strings in map
+//coordinates, with their elevation
+void write_contours(const char* fname) {
+  FILE* f = fopen(fname, "w");
+  if (!f) {
+    printf("cannot write %s\n", fname);
+    return;
+  }
+  fprintf(f, "{\"type\": \"FeatureCollection\", \"features\": [\n");
+  for (unsigned int k = 0; k < contours.size(); k++) {
+    contourLine& line = contours[k];
+    fprintf(f, "{\"type\": \"Feature\", \"properties\": "
+	    "{\"elevation\": %g, \"major\": %d}, ", line.level, line.major);
+    fprintf(f, "\"geometry\": {\"type\": \"LineString\", \"coordinates\": [");
+    for (unsigned int p = 0; p < line.pts.size(); p += 2) {
+      //the centre of cell (i,j) is at (j+0.5, i+0.5) cells from the corner
+      fprintf(f, "%s[%.3f, %.3f]", p ? ", " : "",
+	      minx + (line.pts[p+1] + 0.5)*cell_size,
+	      miny + (line.pts[p] + 0.5)*cell_size);
+    }
+    fprintf(f, "]}}%s\n", k + 1 < contours.size() ? "," : "");
+  }
+  fprintf(f, "]}\n");
+  fclose(f);
+  printf("wrote %s\n", fname);
+}
+
+
+
+/* ************************************************************ */
+/* EXPORT */
+/* In batch mode (-export <prefix>) the rasters are written as ESRI
+   ASCII grids, <prefix>_<name>.asc, and the program exits without
+   opening a window. The files have a header with the size, the lower
+   left corner, the cell size and the NODATA value, then the rows from
+   north to south.
+*/
+
+//write grid to fname; returns 0 if the file can't be written
+int write_ascii_grid(const char* fname, const vector<vector<float> >& grid) {
+  FILE* f = fopen(fname, "w");
+  if (!f) {
+    printf("cannot write %s\n", fname);
+    return 0;
+  }
+  int rows = grid.size();
+  int cols = grid[0].size();
+  fprintf(f, "ncols %d\n", cols);
+  fprintf(f, "nrows %d\n", rows);
+  fprintf(f, "xllcorner %.3f\n", minx);
+  fprintf(f, "yllcorner %.3f\n", miny);
+  fprintf(f, "cellsize %.6f\n", cell_size);
+  fprintf(f, "NODATA_value %d\n", NODATA);
+  //row 0 is the southmost
+  for (int i = rows - 1; i >= 0; i--) {
+    for (int j = 0; j < cols; j++) {
+      if (grid[i][j] == NODATA) fprintf(f, "%d", NODATA);
+      else fprintf(f, "%g", grid[i][j]);
+      fputc(j < cols - 1 ? ' ' : '\n', f);
+    }
+  }
+  fclose(f);
+  printf("wrote %s\n", fname);
+  return 1;
+}
+
+//write grid to <EXPORT_PREFIX>_<name>.asc
+void export_grid(const char* name, const vector<vector<float> >& grid) {
+  if (grid.size() == 0) return;
+  string fname = string(EXPORT_PREFIX) + "_" + name + ".asc";
+  //no ':' in file names, e.g. for "p95:first"
+  for (unsigned int k = 0; k < fname.size(); k++) {
+    if (fname[k] == ':') fname[k] = '_';
+  }
+  write_ascii_grid(fname.c_str(), grid);
+}
+
+//write all the rasters computed so far, the contours and the buildings
+void export_grids() {
+  if (contours.size() > 0) {
+    write_contours((string(EXPORT_PREFIX) + "_contours.geojson").c_str());
+  }
+  if (BUILDINGS) {
+    write_buildings((string(EXPORT_PREFIX) + "_buildings.geojson").c_str());
+  }
+  if (ROOF_PLANES) write_roof_planes(EXPORT_PREFIX);
+  export_grid("elevation", elevation);
+  export_grid("last", last_grid);
+  export_grid("slope", slope_deg);
+  export_grid("slope_pct", slope_pct);
+  export_grid("aspect", aspect);
+  export_grid("skyview", sky_view);
+  export_grid("viewshed", viewshed);
+  export_grid("chm", chm);
+  export_grid("cover", canopy_cover);
+  export_grid("filled", filled_dem);
+  export_grid("flowdir", flow_dir);
+  export_grid("flowacc", flow_acc);
+  for (unsigned int s = 0; s < user_stats.size(); s++) {
+    export_grid(user_stats[s].name, user_stats[s].grid);
+  }
+}
+
+
+//puts points into elevation grid
+void gridify(){
+  int num_cells = points.size()/point_density;
+
+  //bounding box size
+  float h = maxy - miny;
+  float w  = maxx - minx;
+
+  //average grid square length
+  float delta = sqrt(h*w/float(num_cells));
+  cell_size = delta;
+
+  int rows = ceil(h/delta);
+  int cols = ceil(w/delta);
+  grid_rows = rows;
+  grid_cols = cols;
+
+  //put the points of each grid cell next to each other
+  bin_points();
+
+  //the first return and last return grids, and the lowest last
+  //return for the morphological and cloth filters, are computed in the same
+  //sweep as the statistics the user asked for
+  vector<cellStat> stats(user_stats);
+  int first_avg = stats.size();
+  stats.push_back(make_cell_stat("mean:first", STAT_MEAN, FIRST_RETURN));
+  int last_avg = stats.size();
+  stats.push_back(make_cell_stat("mean:last", STAT_MEAN, LAST_RETURN));
+  int last_min = stats.size();
+  stats.push_back(make_cell_stat("min:last", STAT_MIN, LAST_RETURN));
+  //the canopy surface and cover
+  int first_max = stats.size();
+  if (CHM) {
+    stats.push_back(make_cell_stat("max:first", STAT_MAX, FIRST_RETURN));
+  }
+
+  compute_cell_stats(stats, CHM ? &canopy_cover : NULL);
+  if (CHM) chm.swap(stats[first_max].grid);
+
+  elevation.swap(stats[first_avg].grid);
+  min_last_grid.swap(stats[last_min].grid);
+  if (LOWEST_GROUND) {
+    last_grid = min_last_grid;
+  } else {
+    last_grid.swap(stats[last_avg].grid);
+  }
+  for (unsigned int s = 0; s < user_stats.size(); s++) {
+    user_stats[s].grid.swap(stats[s].grid);
+    print_cell_stat(user_stats[s]);
+  }
+
+  //fill the holes, so that the hill shade has no NODATA triangles and
+  //the BFS in find_ground is not cut by them
+  if (FILL_RADIUS > 0) {
+    int filled = fill_nodata(elevation, FILL_RADIUS);
+    int filled_last = fill_nodata(last_grid, FILL_RADIUS);
+    fill_nodata(min_last_grid, FILL_RADIUS);
+    printf("filled %d elevation and %d last return NODATA cells\n",
+	   filled, filled_last);
+  }
+
+  //find the lowest average ground point. This is used instead of
+  //the min_z value since min_z is affected by weird LIDAR noise.
+  min_elevation = maxz;
+  for (int i = 0; i < rows; i++) {
+    for (int j = 0; j < cols; j++) {
+      if (elevation[i][j] != NODATA && elevation[i][j] < min_elevation) {
+	min_elevation = elevation[i][j];
+      }
+    }
+  }
+
+  //find the ground
+  is_ground = classify_ground();
+
+  //replace elevation by the bare earth TIN
+  if (TIN_SOURCE != TIN_NONE) build_ground_tin();
+
+  if (CHM) compute_chm();
+
+  compute_slope_aspect(elevation);
+  if (CAST_SHADOWS) compute_shadows();
+  if (SKY_DIRECTIONS > 0) compute_sky_view();
+  if (observers.size() > 0) compute_viewsheds();
+  if (FLOW) compute_flow();
+  if (contour_intervals.size() > 0) compute_contours();
+  if (BUILDINGS) extract_buildings();
+  if (ROOF_PLANES) compute_roof_planes();
+}
+
+
+
+/* ************************************************************ */
+/* SPATIAL SORT */
+/* The points arrive in scan line order, so consecutive points in
+   points[] can be far apart. Sorting them by the Morton (Z-order) code
+   of their quantized (x,y) puts points that are close in the plane
+   close in memory, so gridding and neighbourhood queries walk memory
+   nearly sequentially.
+*/
+
+//spread the 16 bits of v so that they occupy the even bits
+uint32_t spread_bits(uint32_t v) {
+  v &= 0x0000ffff;
+  v = (v | (v << 8)) & 0x00ff00ff;
+  v = (v | (v << 4)) & 0x0f0f0f0f;
+  v = (v | (v << 2)) & 0x33333333;
+  v = (v | (v << 1)) & 0x55555555;
+  return v;
+}
+
+//Morton code of p: x and y are quantized to 16 bits over the
+//bounding box and their bits interleaved
+uint32_t morton_code(lidarPoint p) {
+  float w = (maxx > minx) ? maxx - minx : 1;
+  float h = (maxy > miny) ? maxy - miny : 1;
+  uint32_t qx = (uint32_t)((p.x - minx)/w * 65535.0f);
+  uint32_t qy = (uint32_t)((p.y - miny)/h * 65535.0f);
+  return spread_bits(qx) | (spread_bits(qy) << 1);
+}
+
+
+/* Sort keys[] and carry idx[] along, with a least significant digit
+   radix sort on 8 bit digits. Each pass is parallel: every thread
+   counts the digits in its own chunk, the counts are prefix summed in
+   (digit, thread) order, and every thread scatters its chunk. This
+   keeps each pass stable. Passes where all keys have the same digit
+   are skipped.
+*/
+void radix_sort(vector<uint32_t>& keys, vector<int>& idx) {
+  int n = keys.size();
+  vector<uint32_t> keys2(n);
+  vector<int> idx2(n);
+  vector<int> count(256*omp_get_max_threads());
+
+  for (int shift = 0; shift < 32; shift += 8) {
+    int skip = 0;
+
+#pragma omp parallel
+    {
+      int nt = omp_get_num_threads();
+      int t = omp_get_thread_num();
+      int lo = (long)n*t/nt, hi = (long)n*(t+1)/nt;
+      int* c = &count[256*t];
+
+      for (int d = 0; d < 256; d++) c[d] = 0;
+      for (int i = lo; i < hi; i++) c[(keys[i] >> shift) & 0xff]++;
+
+#pragma omp barrier
+#pragma omp single
+      {
+	//turn the counts into start offsets, digit major
+	int sum = 0;
+	for (int d = 0; d < 256; d++) {
+	  int total = 0;
+	  for (int k = 0; k < nt; k++) total += count[256*k + d];
+	  if (total == n) skip = 1;
+	  for (int k = 0; k < nt; k++) {
+	    int tmp = count[256*k + d];
+	    count[256*k + d] = sum;
+	    sum += tmp;
+	  }
+	}
+      } //implicit barrier
+
+      if (!skip) {
+	for (int i = lo; i < hi; i++) {
+	  int pos = c[(keys[i] >> shift) & 0xff]++;
+	  keys2[pos] = keys[i];
+	  idx2[pos] = idx[i];
+	}
+      }
+    } //omp parallel
+
+    if (!skip) {
+      keys.swap(keys2);
+      idx.swap(idx2);
+    }
+  }
+}
+
+
+//sort points[] along a Morton curve
+void morton_sort_points() {
+  int n = points.size();
+  vector<uint32_t> keys(n);
+  vector<int> idx(n);
+
+#pragma omp parallel for
+  for (int i = 0; i < n; i++) {
+    keys[i] = morton_code(points[i]);
+    idx[i] = i;
+  }
+
+  radix_sort(keys, idx);
+
+  vector<lidarPoint> sorted(n);
+#pragma omp parallel for
+  for (int i = 0; i < n; i++) {
+    sorted[i] = points[idx[i]];
+  }
+  points.swap(sorted);
+  printf("sorted points along a Morton curve\n");
+}
+
+
+
+/* ************************************************************ */
+/* KD-TREE */
+/* A kd-tree over points[], laid out implicitly in arrays: the node for
+   the range [lo,hi) of tree positions has its median at mid =
+   lo+(hi-lo)/2, its left subtree is [lo,mid) and its right subtree is
+   [mid+1,hi). There are no node structs or pointers; a node only
+   stores its split dimension, in kd_dim[mid]. Ranges of at most
+   KD_LEAF points are leaves and are scanned.
+
+   The coordinates are copied into kd_xyz in tree order, so a query
+   touches one small contiguous array. Queries return indices into
+   points[]. A query point that is itself in the tree is found at
+   distance 0.
+*/
+#define KD_LEAF 8
+//subtrees larger than this are built as separate parallel tasks
+#define KD_TASK_SIZE 20000
+
+vector<int> kd_index; //kd_index[k]: the index in points[] at position k
+vector<float> kd_xyz; //x,y,z of the point at tree position k, at 3k
+vector<unsigned char> kd_dim; //split dimension of the node with median k
+
+float coord(const lidarPoint& p, int d) {
+  return (d == 0) ? p.x : ((d == 1) ? p.y : p.z);
+}
+
+//orders indices in points[] by one coordinate
+struct coordLess {
+  int d;
+  coordLess(int dim): d(dim) {}
+  bool operator()(int a, int b) const {
+    return coord(points[a], d) < coord(points[b], d);
+  }
+};
+
+
+//build the subtree on tree positions [lo,hi)
+void kd_build(int lo, int hi) {
+  if (hi - lo <= KD_LEAF) return;
+
+  //split on the dimension where the points are most spread out
+  float mn[3], mx[3];
+  for (int d = 0; d < 3; d++) mn[d] = mx[d] = coord(points[kd_index[lo]], d);
+  for (int k = lo+1; k < hi; k++) {
+    for (int d = 0; d < 3; d++) {
+      float v = coord(points[kd_index[k]], d);
+      if (v < mn[d]) mn[d] = v;
+      if (v > mx[d]) mx[d] = v;
+    }
+  }
+  int dim = 0;
+  for (int d = 1; d < 3; d++) {
+    if (mx[d] - mn[d] > mx[dim] - mn[dim]) dim = d;
+  }
+
+  int mid = lo + (hi - lo)/2;
+  nth_element(kd_index.begin()+lo, kd_index.begin()+mid,
+	      kd_index.begin()+hi, coordLess(dim));
+  kd_dim[mid] = dim;
+
+#pragma omp task if (hi - lo > KD_TASK_SIZE)
+  kd_build(lo, mid);
+#pragma omp task if (hi - lo > KD_TASK_SIZE)
+  kd_build(mid+1, hi);
+#pragma omp taskwait
+}
+
+
+//build the kd-tree over points[]
+void build_kdtree() {
+  int n = points.size();
+  kd_index.resize(n);
+  kd_dim.assign(n, 0);
+  for (int i = 0; i < n; i++) kd_index[i] = i;
+
+#pragma omp parallel
+#pragma omp single
+  kd_build(0, n);
+
+  kd_xyz.resize(3*n);
+#pragma omp parallel for
+  for (int k = 0; k < n; k++) {
+    kd_xyz[3*k] = points[kd_index[k]].x;
+    kd_xyz[3*k+1] = points[kd_index[k]].y;
+    kd_xyz[3*k+2] = points[kd_index[k]].z;
+  }
+}
+
+
+//free the kd-tree; it must be rebuilt when points[] changes
+void clear_kdtree() {
+  vector<int>().swap(kd_index);
+  vector<float>().swap(kd_xyz);
+  vector<unsigned char>().swap(kd_dim);
+}
+
+
+//squared distance between q and the point at tree position k
+inline float kd_dist2(const float* q, int k) {
+  float dx = q[0] - kd_xyz[3*k];
+  float dy = q[1] - kd_xyz[3*k+1];
+  float dz = q[2] - kd_xyz[3*k+2];
+  return dx*dx + dy*dy + dz*dz;
+}
+
+//the k best candidates found so far, sorted by distance
+typedef struct _knnResult {
+  int k, found;
+  int* pos;   //tree positions
+  float* d2;  //squared distances
+} knnResult;
+
+//offer the point at tree position m to res
+inline void knn_offer(knnResult& res, const float* q, int m) {
+  float d2 = kd_dist2(q, m);
+  if (res.found == res.k && d2 >= res.d2[res.k-1]) return;
+
+  //insertion into the sorted arrays; k is small
+  int i = (res.found < res.k) ? res.found++ : res.k-1;
+  while (i > 0 && res.d2[i-1] > d2) {
+    res.d2[i] = res.d2[i-1];
+    res.pos[i] = res.pos[i-1];
+    i--;
+  }
+  res.d2[i] = d2;
+  res.pos[i] = m;
+}
+
+void kd_knn_rec(int lo, int hi, const float* q, knnResult& res) {
+  if (hi - lo <= KD_LEAF) {
+    for (int m = lo; m < hi; m++) knn_offer(res, q, m);
+    return;
+  }
+  int mid = lo + (hi - lo)/2;
+  int d = kd_dim[mid];
+  knn_offer(res, q, mid);
+
+  //the side of the split q is on first, then the other side only if
+  //it can still hold something closer
+  float diff = q[d] - kd_xyz[3*mid+d];
+  if (diff < 0) {
+    kd_knn_rec(lo, mid, q, res);
+    if (res.found < res.k || diff*diff < res.d2[res.k-1])
+      kd_knn_rec(mid+1, hi, q, res);
+  } else {
+    kd_knn_rec(mid+1, hi, q, res);
+    if (res.found < res.k || diff*diff < res.d2[res.k-1])
+      kd_knn_rec(lo, mid, q, res);
+  }
+}
+
+
+/* the k nearest neighbours of q=(x,y,z): their indices in points[]
+   go into nbr[0..k) and their squared distances into d2[0..k), closest
+   first. Returns how many were found (less than k only if there are
+   less than k points). */
+int kd_knn(const float* q, int k, int* nbr, float* d2) {
+  knnResult res;
+  res.k = k;
+  res.found = 0;
+  res.pos = nbr;
+  res.d2 = d2;
+  if (k > 0) kd_knn_rec(0, kd_index.size(), q, res);
+
+  for (int i = 0; i < res.found; i++) nbr[i] = kd_index[nbr[i]];
+  return res.found;
+}
+
+
+void kd_radius_rec(int lo, int hi, const float* q, float r2,
+		   vector<int>& out) {
+  if (hi - lo <= KD_LEAF) {
+    for (int m = lo; m < hi; m++)
+      if (kd_dist2(q, m) <= r2) out.push_back(kd_index[m]);
+    return;
+  }
+  int mid = lo + (hi - lo)/2;
+  int d = kd_dim[mid];
+  if (kd_dist2(q, mid) <= r2) out.push_back(kd_index[mid]);
+
+  float diff = q[d] - kd_xyz[3*mid+d];
+  if (diff <= 0 || diff*diff <= r2) kd_radius_rec(lo, mid, q, r2, out);
+  if (diff >= 0 || diff*diff <= r2) kd_radius_rec(mid+1, hi, q, r2, out);
+}
+
+
+//append to out the indices in points[] of all points within distance
+//r of q=(x,y,z), in no particular order
+void kd_radius(const float* q, float r, vector<int>& out) {
+  kd_radius_rec(0, kd_index.size(), q, r*r, out);
+}
+
+
+//queries per call of the batched queries when all the points are
+//queried, so that the results of one call stay small
+#define QUERY_CHUNK 65536
+
+/* batched kNN: q holds nq query points (x,y,z). The neighbours of
+   query i go into nbr[k*i .. k*i+k) and their squared distances into
+   d2, closest first; missing neighbours are -1. The queries run in
+   parallel; they are fastest when consecutive queries are close
+   together (e.g. in kd_xyz or Morton order). */
+void kd_knn_batch(const float* q, int nq, int k,
+		  vector<int>& nbr, vector<float>& d2) {
+  nbr.assign((long)nq*k, -1);
+  d2.assign((long)nq*k, 0);
+
+#pragma omp parallel for schedule(dynamic, 256)
+  for (int i = 0; i < nq; i++) {
+    kd_knn(q + 3*i, k, &nbr[(long)k*i], &d2[(long)k*i]);
+  }
+}
+
+
+/* batched radius query with the index query (kd_radius or
+   vox_radius): q holds nq query points (x,y,z). The points within
+   distance r of query i are nbr[start[i] .. start[i+1]). Each thread
+   collects its results in its own buffer, and they are copied into nbr
+   once all counts are known. */
+void radius_batch(void (*query)(const float*, float, vector<int>&),
+		  const float* q, int nq, float r,
+		  vector<int>& start, vector<int>& nbr) {
+  start.assign(nq+1, 0);
+  vector<int> buf_start(nq); //where query i starts in its thread's buffer
+  vector<int> owner(nq);     //the thread that ran query i
+  vector<vector<int> > buf(omp_get_max_threads());
+
+#pragma omp parallel
+  {
+    int t = omp_get_thread_num();
+#pragma omp for schedule(dynamic, 256)
+    for (int i = 0; i < nq; i++) {
+      buf_start[i] = buf[t].size();
+      owner[i] = t;
+      query(q + 3*i, r, buf[t]);
+      start[i+1] = buf[t].size() - buf_start[i];
+    }
+  }
+
+  for (int i = 0; i < nq; i++) start[i+1] += start[i];
+  nbr.resize(start[nq]);
+
+#pragma omp parallel for
+  for (int i = 0; i < nq; i++) {
+    copy(buf[owner[i]].begin() + buf_start[i],
+	 buf[owner[i]].begin() + buf_start[i] + (start[i+1] - start[i]),
+	 nbr.begin() + start[i]);
+  }
+}
+
+//batched kd_radius, see radius_batch
+void kd_radius_batch(const float* q, int nq, float r,
+		     vector<int>& start, vector<int>& nbr) {
+  radius_batch(kd_radius, q, nq, r, start, nbr);
+}
+
+
+
+/* ************************************************************ */
+/* VOXEL HASH */
+/* For radius queries at one fixed scale, the points are binned into
+   cubic voxels of side vox_size, and an open addressing hash table
+   maps the integer coordinates of every non-empty voxel to the range
+   of its points. A query with r <= vox_size only needs to look at the
+   27 voxels around the query point.
+
+   The index is built with the same counting sort as bin_points():
+   1. insert every point's voxel in the table and count its points
+   2. prefix sum the counts over the table slots
+   3. scatter the points into their voxel's range
+   The points of the voxel in slot s are vox_points[vox_start[s] ..
+   vox_start[s+1]), and their coordinates are copied to vox_xyz in
+   the same order.
+*/
+#define VOX_EMPTY 0xffffffffffffffffULL
+#define VOX_BITS 21 //bits per voxel coordinate in a key
+
+float vox_size;
+int vox_hash_bits;
+vector<uint64_t> vox_keys; //the voxel in each slot, or VOX_EMPTY
+vector<int> vox_start;     //ranges of the slots in vox_points, see above
+vector<int> vox_points;    //indices in points[], grouped by voxel
+vector<float> vox_xyz;     //x,y,z of vox_points[k], at 3k
+
+
+//integer voxel coordinates of (x,y,z); they are >= 0 inside the
+//bounding box
+inline void voxel_of(const float* q, int* v) {
+  v[0] = (int)floor((q[0] - minx)/vox_size);
+  v[1] = (int)floor((q[1] - miny)/vox_size);
+  v[2] = (int)floor((q[2] - minz)/vox_size);
+}
+
+inline uint64_t voxel_key(const int* v) {
+  return ((uint64_t)v[0] << (2*VOX_BITS)) | ((uint64_t)v[1] << VOX_BITS) |
+    (uint64_t)v[2];
+}
+
+inline uint32_t voxel_hash(uint64_t key) {
+  return (uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> (64 - vox_hash_bits));
+}
+
+
+//the slot of key, or -1 if the voxel is empty. Only valid once the
+//index is built.
+int vox_find(uint64_t key) {
+  uint32_t mask = (1u << vox_hash_bits) - 1;
+  for (uint32_t slot = voxel_hash(key); ; slot = (slot + 1) & mask) {
+    if (vox_keys[slot] == key) return slot;
+    if (vox_keys[slot] == VOX_EMPTY) return -1;
+  }
+}
+
+//the slot of key, claiming an empty slot for it if it is not in the
+//table yet. Safe to call from many threads at once.
+int vox_insert(uint64_t key) {
+  uint32_t mask = (1u << vox_hash_bits) - 1;
+  for (uint32_t slot = voxel_hash(key); ; slot = (slot + 1) & mask) {
+    uint64_t cur = __atomic_load_n(&vox_keys[slot], __ATOMIC_RELAXED);
+    if (cur == VOX_EMPTY) {
+      uint64_t expected = VOX_EMPTY;
+      if (__atomic_compare_exchange_n(&vox_keys[slot], &expected, key, false,
+				      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+	return slot;
+      }
+      cur = expected; //another thread got the slot first
+    }
+    if (cur == key) return slot;
+  }
+}
+
+
+//build the voxel hash index over points[] with voxels of side size
+void build_voxel_index(float size) {
+  int n = points.size();
+  vox_size = size;
+
+  //the voxel coordinates must fit in VOX_BITS bits each, or different
+  //voxels would get the same key
+  float extent[3] = {maxx - minx, maxy - miny, maxz - minz};
+  for (int d = 0; d < 3; d++) {
+    if (ceil(extent[d]/size) >= (1 << VOX_BITS)) {
+      printf("voxel size %g is too small for the bounding box\n", size);
+      exit(1);
+    }
+  }
+
+  //the table is at most half full: there can't be more voxels than
+  //points, nor more than fit in the bounding box
+  double nvox = ((maxx-minx)/size + 1) * ((maxy-miny)/size + 1) *
+    ((maxz-minz)/size + 1);
+  if (nvox > n) nvox = n;
+  vox_hash_bits = 4;
+  while ((1u << vox_hash_bits) < 2*nvox) vox_hash_bits++;
+  int nslots = 1 << vox_hash_bits;
+
+  vox_keys.assign(nslots, VOX_EMPTY);
+  vox_start.assign(nslots+1, 0);
+  vox_points.resize(n);
+  vox_xyz.resize(3*n);
+
+  //pass 1: insert the voxels and count their points into vox_start[s+1]
+#pragma omp parallel for
+  for (int i = 0; i < n; i++) {
+    float q[3] = {points[i].x, points[i].y, points[i].z};
+    int v[3];
+    voxel_of(q, v);
+    int slot = vox_insert(voxel_key(v));
+#pragma omp atomic
+    vox_start[slot+1]++;
+  }
+
+  //pass 2: prefix sum, so vox_start[s+1] is the start of slot s
+  int* counts = &vox_start[1];
+  prefix_sum(counts, nslots);
+
+  //pass 3: scatter; afterwards vox_start[s+1] is the end of slot s
+#pragma omp parallel for
+  for (int i = 0; i < n; i++) {
+    float q[3] = {points[i].x, points[i].y, points[i].z};
+    int v[3];
+    voxel_of(q, v);
+    int slot = vox_find(voxel_key(v));
+    int k;
+#pragma omp atomic capture
+    k = counts[slot]++;
+    vox_points[k] = i;
+    vox_xyz[3*k] = q[0];
+    vox_xyz[3*k+1] = q[1];
+    vox_xyz[3*k+2] = q[2];
+  }
+}
+
+
+//append to out the indices in points[] of all points within distance
+//r of q=(x,y,z), in no particular order. r must be at most vox_size.
+void vox_radius(const float* q, float r, vector<int>& out) {
+  assert(r <= vox_size);
+  float r2 = r*r;
+  int v[3];
+  voxel_of(q, v);
+
+  //distance from q to the lower and upper faces of its voxel, per
+  //axis. Computed the way voxel_of() does, and shrunk a little, so
+  //that rounding can't prune a voxel that holds a neighbour.
+  float lo[3], hi[3];
+  float box_min[3] = {minx, miny, minz};
+  for (int d = 0; d < 3; d++) {
+    float frac = (q[d] - box_min[d])/vox_size - v[d];
+    lo[d] = fmax(frac - 0.01f, 0.0f)*vox_size;
+    hi[d] = fmax(0.99f - frac, 0.0f)*vox_size;
+  }
+
+  int w[3];
+  for (w[0] = v[0]-1; w[0] <= v[0]+1; w[0]++) {
+    for (w[1] = v[1]-1; w[1] <= v[1]+1; w[1]++) {
+      for (w[2] = v[2]-1; w[2] <= v[2]+1; w[2]++) {
+	if (w[0] < 0 || w[1] < 0 || w[2] < 0) continue;
+
+	//skip neighbours that are entirely farther than r
+	float box_d2 = 0;
+	for (int d = 0; d < 3; d++) {
+	  if (w[d] < v[d]) box_d2 += lo[d]*lo[d];
+	  if (w[d] > v[d]) box_d2 += hi[d]*hi[d];
+	}
+	if (box_d2 > r2) continue;
+
+	int slot = vox_find(voxel_key(w));
+	if (slot < 0) continue;
+
+	for (int k = vox_start[slot]; k < vox_start[slot+1]; k++) {
+	  float dx = q[0] - vox_xyz[3*k];
+	  float dy = q[1] - vox_xyz[3*k+1];
+	  float dz = q[2] - vox_xyz[3*k+2];
+	  if (dx*dx + dy*dy + dz*dz <= r2) out.push_back(vox_points[k]);
+	}
+      }
+    }
+  }
+}
+
+//batched vox_radius, see radius_batch
+void vox_radius_batch(const float* q, int nq, float r,
+		      vector<int>& start, vector<int>& nbr) {
+  radius_batch(vox_radius, q, nq, r, start, nbr);
+}
+
+//free the voxel hash index; it is invalid once points[] changes
+void clear_voxel_index() {
+  vector<uint64_t>().swap(vox_keys);
+  vector<int>().swap(vox_start);
+  vector<int>().swap(vox_points);
+  vector<float>().swap(vox_xyz);
+}
+
+
+
+/* ************************************************************ */
+/* OUTLIER REMOVAL */
+/* Stray points far above or below the terrain inflate the bounding
+   box (and with it the grid and the z range of ztoscreen). They are
+   removed after loading, before anything else looks at the points.
+*/
+
+//keep only the points i with keep[i] != 0, in their order. The new
+//positions come from a parallel prefix sum over keep. Returns how
+//many points were removed.
+int keep_points(vector<int>& keep) {
+  int n = points.size();
+  vector<int> pos(keep);
+  prefix_sum(&pos[0], n);
+  int kept = (n > 0) ? pos[n-1] + (keep[n-1] != 0) : 0;
+
+  vector<lidarPoint> kept_points(kept);
+#pragma omp parallel for
+  for (int i = 0; i < n; i++) {
+    if (keep[i]) kept_points[pos[i]] = points[i];
+  }
+  points.swap(kept_points);
+  return n - kept;
+}
+
+
+//recompute the bounding box of points[]
+void update_bounding_box() {
+  if (points.size() == 0) return;
+  float x0 = points[0].x, x1 = x0, y0 = points[0].y, y1 = y0;
+  float z0 = points[0].z, z1 = z0;
+  int n = points.size();
+
+#pragma omp parallel for reduction(min:x0,y0,z0) reduction(max:x1,y1,z1)
+  for (int i = 0; i < n; i++) {
+    x0 = fmin(x0, points[i].x); x1 = fmax(x1, points[i].x);
+    y0 = fmin(y0, points[i].y); y1 = fmax(y1, points[i].y);
+    z0 = fmin(z0, points[i].z); z1 = fmax(z1, points[i].z);
+  }
+  minx = x0; maxx = x1;
+  miny = y0; maxy = y1;
+  minz = z0; maxz = z1;
+}
+
+
+//drop the points classified as low (7) or high (18) noise
+void drop_noise_points() {
+  int n = points.size();
+  vector<int> keep(n);
+#pragma omp parallel for
+  for (int i = 0; i < n; i++) {
+    keep[i] = (points[i].code != 7 && points[i].code != 18);
+  }
+  int removed = keep_points(keep);
+  printf("noise: removed %d of %d points classified 7 or 18\n", removed, n);
+}
+
+
+/* Statistical outlier removal: for every point, the mean distance to
+   its k nearest neighbours. A point is an outlier if its mean is more
+   than nsigma standard deviations above the mean over all points.
+   The kNN queries are batched in kd-tree order, so consecutive
+   queries are close together. */
+void remove_outliers(int k, float nsigma) {
+  int n = points.size();
+  if (n <= k) return;
+  build_kdtree();
+
+  //mean distance to the k nearest neighbours of the point at tree
+  //position m; the point itself is the first of its k+1 nearest
+  vector<float> mean_dist(n);
+  vector<int> nbr;
+  vector<float> d2;
+  for (int c0 = 0; c0 < n; c0 += QUERY_CHUNK) {
+    int cn = min(QUERY_CHUNK, n - c0);
+    kd_knn_batch(&kd_xyz[3*c0], cn, k+1, nbr, d2);
+#pragma omp parallel for
+    for (int j = 0; j < cn; j++) {
+      float sum = 0;
+      for (int m = 1; m <= k; m++) sum += sqrt(d2[(long)(k+1)*j + m]);
+      mean_dist[c0 + j] = sum/k;
+    }
+  }
+
+  double sum = 0, sum2 = 0;
+#pragma omp parallel for reduction(+:sum,sum2)
+  for (int m = 0; m < n; m++) {
+    sum += mean_dist[m];
+    sum2 += (double)mean_dist[m]*mean_dist[m];
+  }
+  double mean = sum/n;
+  double sigma = sqrt(fmax(sum2/n - mean*mean, 0));
+  float threshold = mean + nsigma*sigma;
+
+  vector<int> keep(n);
+#pragma omp parallel for
+  for (int m = 0; m < n; m++) {
+    keep[kd_index[m]] = (mean_dist[m] <= threshold);
+  }
+
+  //the tree indexes the old points[]; don't let anybody use it
+  clear_kdtree();
+
+  int removed = keep_points(keep);
+  printf("outliers: removed %d of %d points; mean %d-NN distance %f, "
+	 "sigma %f, threshold %f\n", removed, n, k, mean, sigma, threshold);
+}
+
+
+/* Radius outlier removal: a point is an outlier if fewer than
+   min_nbr other points are within distance r of it. The radius
+   queries are batched in kd-tree order, like the kNN queries of
+   remove_outliers(). */
+void remove_radius_outliers(float r, int min_nbr) {
+  int n = points.size();
+  if (n == 0) return;
+  build_kdtree();
+
+  vector<int> keep(n);
+  vector<int> start, nbr;
+  long total = 0;
+  for (int c0 = 0; c0 < n; c0 += QUERY_CHUNK) {
+    int cn = min(QUERY_CHUNK, n - c0);
+    kd_radius_batch(&kd_xyz[3*c0], cn, r, start, nbr);
+    //the point itself is one of the points within r
+#pragma omp parallel for
+    for (int j = 0; j < cn; j++) {
+      keep[kd_index[c0 + j]] = (start[j+1] - start[j] - 1 >= min_nbr);
+    }
+    total += start[cn];
+  }
+
+  clear_kdtree();
+
+  int removed = keep_points(keep);
+  printf("radius outliers: removed %d of %d points with less than %d "
+	 "neighbours within %g; %.1f neighbours on average\n",
+	 removed, n, min_nbr, r, (double)total/n - 1);
+}
+
+
+
+/* ************************************************************ */
+/* THINNING */
+/* Viewing doesn't need every point of a dense scan. THIN_NTH and
+   THIN_RANDOM are applied while the file is read, so the dropped
+   points are never stored: thin_stream() decides for each point as it
+   is read (THIN_RANDOM is a reservoir sample, so it keeps exactly
+   THIN_VALUE points). THIN_VOXEL, THIN_LOWEST and THIN_HIGHEST need
+   the points binned, and are applied by thin_points() once the file
+   is read and cleaned.
+*/
+
+/* point p is the i-th point read (from 0). Returns the index in
+   points[] where p goes: points.size() to append it, a smaller index
+   to replace a point, or -1 to drop it. */
+long thin_stream(long i) {
+  switch (THIN_MODE) {
+  case THIN_NTH:
+    return (i % (long)THIN_VALUE == 0) ? (long)points.size() : -1;
+  case THIN_RANDOM: {
+    long target = (long)THIN_VALUE;
+    if ((long)points.size() < target) return points.size();
+    long j = (long)(drand48()*(i+1));
+    return (j < target) ? j : -1;
+  }
+  default:
+    return points.size();
+  }
+}
+
+
+//of the points in vox_points[lo..hi), keep the one closest to their
+//centroid
+void keep_closest_to_centroid(int lo, int hi, vector<int>& keep) {
+  float cx = 0, cy = 0, cz = 0;
+  for (int k = lo; k < hi; k++) {
+    cx += vox_xyz[3*k]; cy += vox_xyz[3*k+1]; cz += vox_xyz[3*k+2];
+  }
+  cx /= (hi-lo); cy /= (hi-lo); cz /= (hi-lo);
+
+  int best = lo;
+  float best_d2 = BIGINT;
+  for (int k = lo; k < hi; k++) {
+    float dx = vox_xyz[3*k]-cx, dy = vox_xyz[3*k+1]-cy, dz = vox_xyz[3*k+2]-cz;
+    float d2 = dx*dx + dy*dy + dz*dz;
+    if (d2 < best_d2) {
+      best_d2 = d2;
+      best = k;
+    }
+  }
+  keep[vox_points[best]] = 1;
+}
+
+
+//apply THIN_VOXEL, THIN_LOWEST or THIN_HIGHEST to points[]
+void thin_points() {
+  int n = points.size();
+  if (n == 0) return;
+  vector<int> keep(n, 0);
+
+  if (THIN_MODE == THIN_VOXEL) {
+    build_voxel_index(THIN_VALUE);
+    int nslots = vox_keys.size();
+#pragma omp parallel for schedule(dynamic, 1024)
+    for (int s = 0; s < nslots; s++) {
+      if (vox_start[s+1] > vox_start[s])
+	keep_closest_to_centroid(vox_start[s], vox_start[s+1], keep);
+    }
+    clear_voxel_index();
+  }
+  else {
+    //bin into cells of side THIN_VALUE; gridify() rebins later
+    cell_size = THIN_VALUE;
+    double rows = ceil((maxy - miny)/cell_size) + 1;
+    double cols = ceil((maxx - minx)/cell_size) + 1;
+    if (rows*cols >= INT_MAX) {
+      printf("thinning cell size %g is too small for the bounding box\n",
+	     THIN_VALUE);
+      exit(1);
+    }
+    grid_rows = rows;
+    grid_cols = cols;
+    bin_points();
+
+    int num_cells = grid_rows*grid_cols;
+    int lowest = (THIN_MODE == THIN_LOWEST);
+#pragma omp parallel for schedule(dynamic, 1024)
+    for (int c = 0; c < num_cells; c++) {
+      if (cell_start[c+1] == cell_start[c]) continue;
+      int best = cell_points[cell_start[c]];
+      for (int m = cell_start[c]+1; m < cell_start[c+1]; m++) {
+	int i = cell_points[m];
+	if (lowest ? points[i].z < points[best].z : points[i].z > points[best].z)
+	  best = i;
+      }
+      keep[best] = 1;
+    }
+  }
+
+  int removed = keep_points(keep);
+  printf("thinning: kept %d of %d points\n", n - removed, n);
+}
+
+
+
+/* ************************************************************ */
+/* POINT FEATURES */
+/* For every point, the covariance of its neighbours and its
+   eigenvalues l1 >= l2 >= l3 describe the local shape: a line has one
+   large eigenvalue, a plane (roof, ground) two, a volume (tree crown)
+   three. The eigenvector of l3 is the surface normal.
+
+   The neighbours are the k nearest, from the kd-tree, or those within
+   a fixed radius, from the voxel hash with voxels of that side. They
+   come from the batched queries, QUERY_CHUNK points at a time, in
+   the order of the index so that consecutive queries are close.
+   The points of a chunk are processed in blocks of FEAT_BLOCK. For a
+   block, the covariances are gathered into one array per component; the 3x3 eigenproblems are then solved in closed form
+   (no iterations, no branches on the data), in loops the compiler can
+   vectorize across the points of the block.
+*/
+#define FEAT_BLOCK 64
+
+
+/* eigenvalues e1 >= e2 >= e3 and the unit eigenvector (nx,ny,nz) of
+   e3, for the n symmetric matrices (a b c; b d e; c e f). Uses the
+   trigonometric solution of the characteristic cubic. */
+void eigen3_block(int n, const float* a, const float* b, const float* c,
+		  const float* d, const float* e, const float* f,
+		  float* e1, float* e2, float* e3,
+		  float* nx, float* ny, float* nz) {
+#pragma omp simd
+  for (int i = 0; i < n; i++) {
+    float m = (a[i] + d[i] + f[i])/3;
+    float ka = a[i] - m, kd = d[i] - m, kf = f[i] - m;
+    float p = (ka*ka + kd*kd + kf*kf +
+	       2*(b[i]*b[i] + c[i]*c[i] + e[i]*e[i]))/6;
+    float q = (ka*(kd*kf - e[i]*e[i]) - b[i]*(b[i]*kf - e[i]*c[i]) +
+	       c[i]*(b[i]*e[i] - kd*c[i]))/2;
+    float sp = sqrtf(p);
+    float r = (p > 1e-20f) ? q/(p*sp) : 0;
+    r = fminf(fmaxf(r, -1.0f), 1.0f);
+    float phi = acosf(r)/3;
+    e1[i] = m + 2*sp*cosf(phi);
+    e3[i] = m + 2*sp*cosf(phi + 2.0943951f); //2pi/3
+    e2[i] = 3*m - e1[i] - e3[i];
+  }
+
+  //the normal is orthogonal to the rows of C - e3 I; take the longest
+  //of the cross products of two rows
+#pragma omp simd
+  for (int i = 0; i < n; i++) {
+    float r0x = a[i]-e3[i], r0y = b[i], r0z = c[i];
+    float r1x = b[i], r1y = d[i]-e3[i], r1z = e[i];
+    float r2x = c[i], r2y = e[i], r2z = f[i]-e3[i];
+
+    float ax = r0y*r1z - r0z*r1y, ay = r0z*r1x - r0x*r1z, az = r0x*r1y - r0y*r1x;
+    float bx = r0y*r2z - r0z*r2y, by = r0z*r2x - r0x*r2z, bz = r0x*r2y - r0y*r2x;
+    float cx = r1y*r2z - r1z*r2y, cy = r1z*r2x - r1x*r2z, cz = r1x*r2y - r1y*r2x;
+    float la = ax*ax + ay*ay + az*az;
+    float lb = bx*bx + by*by + bz*bz;
+    float lc = cx*cx + cy*cy + cz*cz;
+
+    float vx = ax, vy = ay, vz = az, l = la;
+    if (lb > l) { vx = bx; vy = by; vz = bz; l = lb; }
+    if (lc > l) { vx = cx; vy = cy; vz = cz; l = lc; }
+
+    //degenerate neighbourhood (e.g. all points equal): call it flat
+    float inv = (l > 0) ? 1/sqrtf(l) : 0;
+    if (vz < 0) inv = -inv; //face up
+    nx[i] = vx*inv;
+    ny[i] = vy*inv;
+    nz[i] = (l > 0) ? vz*inv : 1;
+  }
+}
+
+
+//compute the POINT FEATURES of all points from their k nearest
+//neighbours, or from their neighbours within radius if radius > 0
+void compute_point_features(int k, float radius) {
+  int n = points.size();
+  if (n == 0) return;
+  if (k > n) k = n;
+  double start = omp_get_wtime();
+
+  //the query points, in the order of the index, and their indices in
+  //points[]
+  const float* xyz;
+  const int* index;
+  if (radius > 0) {
+    build_voxel_index(radius);
+    xyz = &vox_xyz[0];
+    index = &vox_points[0];
+  } else {
+    build_kdtree();
+    xyz = &kd_xyz[0];
+    index = &kd_index[0];
+  }
+  feat_normal.resize(3*n);
+  feat_linearity.resize(n);
+  feat_planarity.resize(n);
+  feat_scattering.resize(n);
+  feat_verticality.resize(n);
+
+  //the neighbours of query j of a chunk are nbr[nbr_start[j] ..
+  //nbr_start[j+1])
+  vector<int> nbr_start, nbr;
+  vector<float> d2;
+  long total = 0;
+  for (int c0 = 0; c0 < n; c0 += QUERY_CHUNK) {
+    int cn = min(QUERY_CHUNK, n - c0);
+    if (radius > 0) {
+      vox_radius_batch(xyz + 3*c0, cn, radius, nbr_start, nbr);
+    } else {
+      kd_knn_batch(xyz + 3*c0, cn, k, nbr, d2);
+      nbr_start.resize(cn+1);
+      for (int j = 0; j <= cn; j++) nbr_start[j] = k*j;
+    }
+    total += nbr_start[cn];
+
+#pragma omp parallel
+    {
+      //one array per covariance component, and per result
+      float cov[6][FEAT_BLOCK];
+      float e1[FEAT_BLOCK], e2[FEAT_BLOCK], e3[FEAT_BLOCK];
+      float nx[FEAT_BLOCK], ny[FEAT_BLOCK], nz[FEAT_BLOCK];
+
+#pragma omp for schedule(dynamic, 1)
+      for (int block = c0; block < c0 + cn; block += FEAT_BLOCK) {
+	int bn = min(FEAT_BLOCK, c0 + cn - block);
+
+	//gather the covariances of the block
+	for (int j = 0; j < bn; j++) {
+	  const float* q = xyz + 3*(block+j);
+	  const int* nb = &nbr[nbr_start[block+j-c0]];
+	  int found = nbr_start[block+j-c0+1] - nbr_start[block+j-c0];
+
+	  //relative to q, to keep the precision of float coordinates
+	  float sx = 0, sy = 0, sz = 0;
+	  float sxx = 0, sxy = 0, sxz = 0, syy = 0, syz = 0, szz = 0;
+	  for (int m = 0; m < found; m++) {
+	    lidarPoint& p = points[nb[m]];
+	    float dx = p.x - q[0], dy = p.y - q[1], dz = p.z - q[2];
+	    sx += dx; sy += dy; sz += dz;
+	    sxx += dx*dx; sxy += dx*dy; sxz += dx*dz;
+	    syy += dy*dy; syz += dy*dz; szz += dz*dz;
+	  }
+	  float mx = sx/found, my = sy/found, mz = sz/found;
+	  cov[0][j] = sxx/found - mx*mx;
+	  cov[1][j] = sxy/found - mx*my;
+	  cov[2][j] = sxz/found - mx*mz;
+	  cov[3][j] = syy/found - my*my;
+	  cov[4][j] = syz/found - my*mz;
+	  cov[5][j] = szz/found - mz*mz;
+	}
+
+	eigen3_block(bn, cov[0], cov[1], cov[2], cov[3], cov[4], cov[5],
+		     e1, e2, e3, nx, ny, nz);
+
+	//features, scattered back to the order of points[]
+	for (int j = 0; j < bn; j++) {
+	  int i = index[block+j];
+	  float l1 = fmaxf(e1[j], 1e-12f);
+	  float l2 = fmaxf(e2[j], 0.0f), l3 = fmaxf(e3[j], 0.0f);
+	  feat_linearity[i] = (l1 - l2)/l1;
+	  feat_planarity[i] = (l2 - l3)/l1;
+	  feat_scattering[i] = l3/l1;
+	  feat_normal[3*i] = nx[j];
+	  feat_normal[3*i+1] = ny[j];
+	  feat_normal[3*i+2] = nz[j];
+	  feat_verticality[i] = 1 - fabsf(nz[j]);
+	}
+      }
+    }
+  }
+
+  //nothing else queries the voxel hash
+  if (radius > 0) clear_voxel_index();
+
+  double secs = omp_get_wtime() - start;
+  double lin = 0, pla = 0, sca = 0, ver = 0;
+  for (int i = 0; i < n; i++) {
+    lin += feat_linearity[i]; pla += feat_planarity[i];
+    sca += feat_scattering[i]; ver += feat_verticality[i];
+  }
+  if (radius > 0) {
+    printf("features (r=%g, %.1f neighbours on average): ", radius,
+	   (double)total/n);
+  } else {
+    printf("features (k=%d): ", k);
+  }
+  printf("%d points in %.2fs (%.0f points/s); mean linearity %.3f "
+	 "planarity %.3f scattering %.3f verticality %.3f\n",
+	 n, secs, n/secs, lin/n, pla/n, sca/n, ver/n);
+}
+
+
+
+/* NOTE: file.txt must be obtained from file.las with las2txt with
+   -parse xyznrc in this order
+
+   last2txt -o file.las -o file.txt -parse xyznrc
+ */
+//reads the points from file in global array points
+void readPointsFromFile(char* fname) {
+
+  FILE* file = fopen(fname, "r");
+  if (!file) {
+    printf("cannot open file %s\n",  fname);
+    exit(1);
+  }
+
+  lidarPoint p;
+  long nread = 0;
+  srand48(1); //THIN_RANDOM picks the same points every run
+  while (1) {
+    //-parse xyzcr
+    if (fscanf(file, "%f %f %f %d %d %d",
+	       &p.x, &p.y, &p.z, &p.nb_of_returns, &p.return_number, &p.code) <6)  break;
+
+    //else: if we are here,  we got another point
+    //printf("reading %f, %f, %f\n", p.x, p.y, p.z);
+
+
+    //insert the point in points[] array, unless thinning drops it
+    p.mycode=0; //everything unclassified
+    long slot = thin_stream(nread++);
+    if (slot < 0) continue;
+    if (slot < (long)points.size()) {
+      points[slot] = p;
+    } else {
+      points.push_back(p);
+    }
+
+    //update bounding box
+    if (points.size() == 1) {
+      minx=maxx = p.x;
+      miny=maxy = p.y;
+      minz=maxz = p.z;
+    } else {
+      if (minx > p.x) minx=p.x;
+      if (maxx < p.x) maxx = p.x;
+      if (miny > p.y) miny=p.y;
+      if (maxy < p.y) maxy = p.y;
+      if (minz > p.z) minz=p.z;
+      if (maxz < p.z) maxz = p.z;
+    }
+  } //while
+
+  fclose(file);
+
+  //thinning while reading: the bounding box above is that of all the
+  //points read
+  if (THIN_MODE == THIN_NTH || THIN_MODE == THIN_RANDOM) {
+    printf("thinning: kept %d of %ld points\n", (int)points.size(), nread);
+    update_bounding_box();
+  }
+
+  //print info
+  printf("total %d points in  [%f, %f], [%f,%f], [%f,%f]\n",
+	 (int)points.size(), minx, maxx, miny,maxy, minz, maxz);
+
+  //clean up the points before gridding; this can shrink the bounding
+  //box, and with it the grid
+  if (DROP_NOISE || SOR_K > 0 || ROR_RADIUS > 0) {
+    if (DROP_NOISE) drop_noise_points();
+    if (SOR_K > 0) remove_outliers(SOR_K, SOR_NSIGMA);
+    if (ROR_RADIUS > 0) remove_radius_outliers(ROR_RADIUS, ROR_MIN);
+    update_bounding_box();
+    printf("after cleaning %d points in  [%f, %f], [%f,%f], [%f,%f]\n",
+	   (int)points.size(), minx, maxx, miny,maxy, minz, maxz);
+  }
+
+  if (THIN_MODE == THIN_VOXEL || THIN_MODE == THIN_LOWEST ||
+      THIN_MODE == THIN_HIGHEST) {
+    thin_points();
+    update_bounding_box();
+  }
+
+  if (MORTON_SORT) morton_sort_points();
+  if (FEATURE_K > 0 || FEATURE_RADIUS > 0) {
+    compute_point_features(FEATURE_K, FEATURE_RADIUS);
+  }
+  gridify();
+}
+
+
+
+void print_usage(char* prog) {
+  printf("usage: %s <file>.txt <density> <building slope threshold> [options]\n", prog);
+  printf("options:\n");
+  printf("  -morton   sort the points along a Morton curve after loading\n");
+  printf("  -stat <stat>[:<return>]\n");
+  printf("            compute a per cell statistic; <stat> is min, max, count, mean,\n");
+  printf("            stddev, median or pNN (NN-th percentile); <return> is all,\n");
+  printf("            first, last, many, single or intermediate. Can be repeated\n");
+  printf("  -lowest_ground\n");
+  printf("            find the ground on the lowest last return of each cell\n");
+  printf("  -ground <bfs|pmf|csf>\n");
+  printf("            classify the ground with the slope BFS (default), the\n");
+  printf("            progressive morphological filter or the cloth simulation\n");
+  printf("            filter (both run on the lowest last returns)\n");
+  printf("  -fill <radius>\n");
+  printf("            fill NODATA cells within radius cells of valid data\n");
+  printf("  -tin <code|cells>\n");
+  printf("            triangulate the ground (points with code 2, or the centres\n");
+  printf("            of the cells classified ground) and use the TIN as elevation\n");
+  printf("  -sor <k> <nsigma>\n");
+  printf("            remove points whose mean distance to their k nearest\n");
+  printf("            neighbours is more than nsigma deviations above average\n");
+  printf("  -ror <radius> <min>\n");
+  printf("            remove points with less than min neighbours within radius\n");
+  printf("  -drop_noise\n");
+  printf("            remove points classified as noise (7 and 18)\n");
+  printf("  -features <k> | -features radius <r>\n");
+  printf("            compute per point normals, linearity, planarity,\n");
+  printf("            scattering and verticality from the k nearest neighbours,\n");
+  printf("            or from the neighbours within r\n");
+  printf("  -thin <mode> <value>\n");
+  printf("            thin the points when loading; <mode> is nth (keep every\n");
+  printf("            value-th point), random (keep value points), voxel (one\n");
+  printf("            point per voxel of side value), lowest or highest (one\n");
+  printf("            point per cell of side value)\n");
+  printf("  -sun <azimuth> <altitude>\n");
+  printf("            sun of the hill shade, in degrees clockwise from north and\n");
+  printf("            above the horizon (default 225 35.26)\n");
+  printf("  -shadows  cast the shadows of the sun(s) on the hill shade\n");
+  printf("  -skyview <n>\n");
+  printf("            shade the grid by its sky view factor, from the horizons\n");
+  printf("            in n directions\n");
+  printf("  -viewshed <x> <y> <height>\n");
+  printf("            add an observer with the eye at height above the ground;\n");
+  printf("            can be repeated. The cells seen are overlaid in color\n");
+  printf("  -observers <file>\n");
+  printf("            add the observers in file, one \"x y height\" per line\n");
+  printf("  -chm      canopy height model (highest first return above the\n");
+  printf("            ground, pits filled) and canopy cover\n");
+  printf("  -buildings\n");
+  printf("            label the building cells into buildings, with their area,\n");
+  printf("            height, roof slope and simplified footprint\n");
+  printf("  -roofs    find the roof planes of the buildings (implies -buildings)\n");
+  printf("  -flow     fill the depressions of the ground and compute D8 flow\n");
+  printf("            directions and flow accumulation\n");
+  printf("  -contours <interval>[,<interval>...]\n");
+  printf("            contour lines at the multiples of the intervals, the\n");
+  printf("            largest one thicker\n");
+  printf("  -export <prefix>\n");
+  printf("            batch mode: write the rasters to <prefix>_<name>.asc (ESRI\n");
+  printf("            ASCII grids) and exit\n");
+  printf("  -multisun <n>\n");
+  printf("            blend n suns (2 to %d) spread around the azimuth\n",
+	 MAX_SUN_DIRECTIONS);
+}
+
+
+int main(int argc, char** argv) {
+  //read number of points from user
+  if (argc < 4) {
+    print_usage(argv[0]);
+    exit(1);
+  }
+  //this allocates and initializes the array that holds the points
+  point_density = atoi(argv[2]);
+  building_slope_threshold = atof(argv[3]);
+
+  //optional flags come after the required arguments
+  for (int i = 4; i < argc; i++) {
+    if (strcmp(argv[i], "-morton") == 0) {
+      MORTON_SORT = 1;
+    }
+    else if (strcmp(argv[i], "-stat") == 0 && i+1 < argc) {
+      cellStat cs;
+      if (!parse_cell_stat(argv[++i], &cs)) {
+	printf("cannot parse statistic %s\n", argv[i]);
+	exit(1);
+      }
+      user_stats.push_back(cs);
+    }
+    else if (strcmp(argv[i], "-lowest_ground") == 0) {
+      LOWEST_GROUND = 1;
+    }
+    else if (strcmp(argv[i], "-ground") == 0 && i+1 < argc) {
+      i++;
+      if (strcmp(argv[i], "bfs") == 0) GROUND_ENGINE = GROUND_BFS;
+      else if (strcmp(argv[i], "pmf") == 0) {
+	GROUND_ENGINE = GROUND_PMF;
+      }
+      else if (strcmp(argv[i], "csf") == 0) {
+	GROUND_ENGINE = GROUND_CSF;
+      }
+      else {
+	printf("unknown ground engine %s\n", argv[i]);
+	exit(1);
+      }
+    }
+    else if (strcmp(argv[i], "-fill") == 0 && i+1 < argc) {
+      FILL_RADIUS = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "-tin") == 0 && i+1 < argc) {
+      i++;
+      if (strcmp(argv[i], "code") == 0) TIN_SOURCE = TIN_CODE;
+      else if (strcmp(argv[i], "cells") == 0) TIN_SOURCE = TIN_CELLS;
+      else {
+	printf("unknown TIN source %s\n", argv[i]);
+	exit(1);
+      }
+    }
+    else if (strcmp(argv[i], "-sor") == 0 && i+2 < argc) {
+      SOR_K = atoi(argv[++i]);
+      SOR_NSIGMA = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "-ror") == 0 && i+2 < argc) {
+      ROR_RADIUS = atof(argv[++i]);
+      ROR_MIN = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "-drop_noise") == 0) {
+      DROP_NOISE = 1;
+    }
+    else if (strcmp(argv[i], "-features") == 0 && i+2 < argc &&
+	     strcmp(argv[i+1], "radius") == 0) {
+      i++;
+      FEATURE_RADIUS = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "-features") == 0 && i+1 < argc) {
+      FEATURE_K = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "-thin") == 0 && i+2 < argc) {
+      char* mode = argv[++i];
+      THIN_VALUE = atof(argv[++i]);
+      if (strcmp(mode, "nth") == 0) THIN_MODE = THIN_NTH;
+      else if (strcmp(mode, "random") == 0) THIN_MODE = THIN_RANDOM;
+      else if (strcmp(mode, "voxel") == 0) THIN_MODE = THIN_VOXEL;
+      else if (strcmp(mode, "lowest") == 0) THIN_MODE = THIN_LOWEST;
+      else if (strcmp(mode, "highest") == 0) THIN_MODE = THIN_HIGHEST;
+      else {
+	printf("unknown thinning mode %s\n", mode);
+	exit(1);
+      }
+      if (THIN_VALUE <= 0 || (THIN_MODE == THIN_NTH && THIN_VALUE < 1)) {
+	printf("thinning value must be positive\n");
+	exit(1);
+      }
+    }
+    else if (strcmp(argv[i], "-sun") == 0 && i+2 < argc) {
+      sun_azimuth = atof(argv[++i]);
+      sun_altitude = atof(argv[++i]);
+      if (sun_altitude < 0 || sun_altitude > 90) {
+	printf("sun altitude must be in [0,90]\n");
+	exit(1);
+      }
+    }
+    else if (strcmp(argv[i], "-shadows") == 0) {
+      CAST_SHADOWS = 1;
+    }
+    else if (strcmp(argv[i], "-skyview") == 0 && i+1 < argc) {
+      SKY_DIRECTIONS = atoi(argv[++i]);
+      if (SKY_DIRECTIONS < 1) {
+	printf("-skyview needs at least 1 direction\n");
+	exit(1);
+      }
+      SHADE_MODE = SHADE_SKY;
+    }
+    else if (strcmp(argv[i], "-viewshed") == 0 && i+3 < argc) {
+      observer o;
+      o.x = atof(argv[++i]);
+      o.y = atof(argv[++i]);
+      o.height = atof(argv[++i]);
+      observers.push_back(o);
+      DRAW_VIEWSHED = 1;
+    }
+    else if (strcmp(argv[i], "-observers") == 0 && i+1 < argc) {
+      read_observers(argv[++i]);
+      DRAW_VIEWSHED = 1;
+    }
+    else if (strcmp(argv[i], "-chm") == 0) {
+      CHM = 1;
+    }
+    else if (strcmp(argv[i], "-buildings") == 0) {
+      BUILDINGS = 1;
+      DRAW_FOOTPRINTS = 1;
+    }
+    else if (strcmp(argv[i], "-roofs") == 0) {
+      BUILDINGS = 1;
+      ROOF_PLANES = 1;
+    }
+    else if (strcmp(argv[i], "-flow") == 0) {
+      FLOW = 1;
+    }
+    else if (strcmp(argv[i], "-contours") == 0 && i+1 < argc) {
+      for (char* tok = strtok(argv[++i], ","); tok; tok = strtok(NULL, ",")) {
+	float step = atof(tok);
+	if (step <= 0) {
+	  printf("contour intervals must be positive\n");
+	  exit(1);
+	}
+	contour_intervals.push_back(step);
+      }
+      DRAW_CONTOURS = 1;
+    }
+    else if (strcmp(argv[i], "-export") == 0 && i+1 < argc) {
+      EXPORT_PREFIX = argv[++i];
+    }
+    else if (strcmp(argv[i], "-multisun") == 0 && i+1 < argc) {
+      SUN_DIRECTIONS = atoi(argv[++i]);
+      if (SUN_DIRECTIONS < 1 || SUN_DIRECTIONS > MAX_SUN_DIRECTIONS) {
+	printf("-multisun takes 1 to %d suns\n", MAX_SUN_DIRECTIONS);
+	exit(1);
+      }
+    }
+    else {
+      printf("unknown option %s\n", argv[i]);
+      print_usage(argv[0]);
+      exit(1);
+    }
+  }
+
+  set_sun();
+  readPointsFromFile(argv[1]);
+
+  if (EXPORT_PREFIX) {
+    export_grids();
+    exit(0);
+  }
+
+  /* OPEN GL STUFF */
+  /* open a window and initialize GLUT stuff */
+  glutInit(&argc, argv);
+  glutInitDisplayMode(GLUT_SINGLE | GLUT_RGB | GLUT_DEPTH);
+  glutInitWindowSize(WINDOWSIZE, WINDOWSIZE);
+  glutInitWindowPosition(100,100);
+  glutCreateWindow(argv[0]);
+
+  /* register callback functions */
+  glutDisplayFunc(display);
+  glutKeyboardFunc(keypress);
+  glutReshapeFunc(reshape);
+
+  /* OpenGL init */
+  /* set background color black*/
+  glClearColor(0, 0, 0, 0);
+  glEnable(GL_DEPTH_TEST);
+
+  // //CAMERA ANGLE CODE
+  // //CAMERA ANGLE CODE
+  // //CAMERA ANGLE CODE
+  // // setup the camera (i.e. the projection transformation)
+  // glMatrixMode(GL_PROJECTION);
+  // glLoadIdentity();
+  // gluPerspective(60, 1 /* aspect */, 1, 10.0); /* the frustrum is from z=-1 to z=-10 */
+  // /* camera is at (0,0,0) looking along negative z axis */
+
+  // //initialize the translation to bring the points in the view frustrum which is [-1, -10]
+  // pos[2] = -2;
+
+  // //initialize rotation to look at it from above
+  // theta[0] = -45;
+
+
+  /* start the event handler */
+  glutMainLoop();
+
+  return 0;
+}
+
+
+
+
+/* compile the mesh of the current view into scene_list. Called by
+   display() only when the geometry or the colors changed. */
+void build_scene_list() {
+  if (scene_list == 0) scene_list = glGenLists(1);
+
+  glNewList(scene_list, GL_COMPILE);
+  if (DRAW_TIN && tin_triangles.size() > 0) {
+    draw_tin();
+  }
+  else if (HILL_SHADE) {
+    draw_ground();
+  }
+  else {
+    draw_hill_shade();
+  }
+  if (DRAW_CONTOURS) draw_contours();
+  if (DRAW_FOOTPRINTS) draw_footprints();
+  glEndList();
+}
+
+
+/* bind frame_fbo for rendering, with its texture at least as large
+   as the window. Returns 0, and leaves the window bound, if the
+   framebuffer objects are not available */
+int bind_frame_fbo() {
+  if (frame_cache == -1) {
+    const char* ext = (const char*)glGetString(GL_EXTENSIONS);
+    frame_cache = (ext && strstr(ext, "GL_EXT_framebuffer_object")) ? 1 : 0;
+    if (frame_cache) {
+      glGenFramebuffersEXT(1, &frame_fbo);
+      glGenRenderbuffersEXT(1, &frame_depth);
+      glGenTextures(1, &frame_tex);
+    } else {
+      printf("no framebuffer objects; exposes will render again\n");
+    }
+  }
+  if (!frame_cache) return 0;
+  glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, frame_fbo);
+
+  //the texture must be a power of 2 in OpenGL 1.x; grow it if needed
+  if (tex_w < window_w || tex_h < window_h) {
+    tex_w = tex_h = 1;
+    while (tex_w < window_w) tex_w *= 2;
+    while (tex_h < window_h) tex_h *= 2;
+    glBindTexture(GL_TEXTURE_2D, frame_tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, tex_w, tex_h, 0,
+		 GL_RGB, GL_UNSIGNED_BYTE, NULL);
+    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT,
+			      GL_TEXTURE_2D, frame_tex, 0);
+    glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, frame_depth);
+    glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_DEPTH_COMPONENT24,
+			     tex_w, tex_h);
+    glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT,
+				 GL_RENDERBUFFER_EXT, frame_depth);
+    if (glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT) !=
+	GL_FRAMEBUFFER_COMPLETE_EXT) {
+      printf("framebuffer object incomplete; exposes will render again\n");
+      glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+      glDeleteFramebuffersEXT(1, &frame_fbo);
+      glDeleteRenderbuffersEXT(1, &frame_depth);
+      glDeleteTextures(1, &frame_tex);
+      frame_cache = 0;
+      return 0;
+    }
+  }
+  return 1;
+}
+
+
+/* draw frame_tex over the whole window */
+void draw_cached_frame() {
+  GLfloat s = window_w/float(tex_w);
+  GLfloat t = window_h/float(tex_h);
+
+  glMatrixMode(GL_PROJECTION);
+  glPushMatrix();
+  glLoadIdentity();
+  glMatrixMode(GL_MODELVIEW);
+  glPushMatrix();
+  glLoadIdentity();
+
+  glDisable(GL_DEPTH_TEST);
+  glEnable(GL_TEXTURE_2D);
+  glBindTexture(GL_TEXTURE_2D, frame_tex);
+  glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+  glBegin(GL_QUADS);
+  glTexCoord2f(0, 0); glVertex2f(-1, -1);
+  glTexCoord2f(s, 0); glVertex2f( 1, -1);
+  glTexCoord2f(s, t); glVertex2f( 1,  1);
+  glTexCoord2f(0, t); glVertex2f(-1,  1);
+  glEnd();
+  glDisable(GL_TEXTURE_2D);
+  glEnable(GL_DEPTH_TEST);
+
+  glPopMatrix();
+  glMatrixMode(GL_PROJECTION);
+  glPopMatrix();
+  glMatrixMode(GL_MODELVIEW);
+}
+
+
+//record that some state affecting the image changed, and ask GLUT
+//for a redisplay. Keypresses that don't change the image must not
+//call this.
+void mark_dirty(int what) {
+  dirty |= what;
+  glutPostRedisplay();
+}
+
+
+/* this function is called whenever the window is resized */
+void reshape(int w, int h) {
+  glViewport(0, 0, w, h);
+  window_w = w;
+  window_h = h;
+  //the cached frame has the wrong size now
+  mark_dirty(DIRTY_CAMERA);
+}
+
+
+/* this function is called whenever the window needs to be rendered */
+void display(void) {
+
+  //nothing changed since the last frame: this is just an expose
+  if (!dirty && frame_cached) {
+    draw_cached_frame();
+    glFlush();
+    return;
+  }
+  //render into frame_tex if we can, else straight into the window
+  frame_cached = bind_frame_fbo();
+
+  if (DRAW_POINTS) {
+    //the points are uploaded once; only their colors can change
+    if (point_vbo == 0) build_point_buffers();
+    if (dirty & DIRTY_COLOR) upload_point_colors();
+  }
+  else if (dirty & (DIRTY_GEOMETRY | DIRTY_COLOR)) {
+    build_scene_list();
+  }
+
+  //clear the screen
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+  //clear all modeling transformations
+  glMatrixMode(GL_MODELVIEW);
+  glLoadIdentity();
+
+  /* The default GL window is x=[-1,1], y= [-1,1] with the origin in
+     the center.  The view frustrum was set up from z=-1 to z=-10. The
+     camera is at (0,0,0) looking along negative z axis.
+  */
+
+ /* First we translate and rotate our local reference system with the
+    user transformation. pos[] represents the cumulative translation
+    entered by the user, and theta[] the cumulative rotation entered
+    by the user */
+  glTranslatef(pos[0], pos[1], pos[2]);
+  glRotatef(theta[0], 1,0,0); //rotate theta[0] around x-axis, etc
+  glRotatef(theta[1], 0,1,0);
+  glRotatef(theta[2], 0,0,1);
+
+  /* We translated the local reference system where we want it to be; now we draw the
+     object in the local reference system.  */
+  if (DRAW_POINTS) {
+    draw_points();
+  }
+  else {
+    glCallList(scene_list);
+  }
+
+  //don't need to draw a cube but I found it nice for perspective
+  //  cube(1); //draw a cube of size 1
+
+  if (frame_cached) {
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    draw_cached_frame();
+  }
+  glFlush();
+  dirty = 0;
+}
+
+
+
+/* this function is called whenever  key is pressed */
+void keypress(unsigned char key, int x, int y) {
+  switch(key) {
+  case 's':
+    HILL_SHADE = !HILL_SHADE;
+    if (!DRAW_POINTS) mark_dirty(DIRTY_GEOMETRY);
+    break;
+
+  case 'i':
+    //switch between the TIN and the grid views
+    if (tin_triangles.size() == 0) {
+      printf("no TIN; run with -tin code or -tin cells\n");
+      break;
+    }
+    DRAW_TIN = !DRAW_TIN;
+    if (!DRAW_POINTS) mark_dirty(DIRTY_GEOMETRY);
+    break;
+
+  case 'a':
+  case 'A':
+    //rotate the sun; the shade comes from the cached normals
+    sun_azimuth += (key == 'a') ? 15 : -15;
+    if (sun_azimuth >= 360) sun_azimuth -= 360;
+    if (sun_azimuth < 0) sun_azimuth += 360;
+    set_sun();
+    if (CAST_SHADOWS) compute_shadows();
+    printf("sun azimuth %.0f altitude %.0f\n", sun_azimuth, sun_altitude);
+    //the hill shade and the TIN use the sun; the ground view doesn't
+    if (!DRAW_POINTS && (!HILL_SHADE || DRAW_TIN)) mark_dirty(DIRTY_COLOR);
+    break;
+
+  case 'e':
+  case 'E':
+    //raise/lower the sun
+    sun_altitude += (key == 'e') ? 5 : -5;
+    if (sun_altitude > 90) sun_altitude = 90;
+    if (sun_altitude < 0) sun_altitude = 0;
+    set_sun();
+    if (CAST_SHADOWS) compute_shadows();
+    printf("sun azimuth %.0f altitude %.0f\n", sun_azimuth, sun_altitude);
+    if (!DRAW_POINTS && (!HILL_SHADE || DRAW_TIN)) mark_dirty(DIRTY_COLOR);
+    break;
+
+  case 'k':
+    //cycle through the shadings: sun, sky view, both
+    SHADE_MODE = (SHADE_MODE + 1) % 3;
+    if (SHADE_MODE != SHADE_SUN && sky_view.size() == 0) {
+      SKY_DIRECTIONS = 16;
+      compute_sky_view();
+    }
+    printf("shading: %s\n", SHADE_MODE == SHADE_SUN ? "sun" :
+	   SHADE_MODE == SHADE_SKY ? "sky view" : "sun and sky view");
+    if (!DRAW_POINTS && !HILL_SHADE) mark_dirty(DIRTY_COLOR);
+    break;
+
+  case 'B':
+    //building footprints on/off
+    if (!BUILDINGS) {
+      printf("no buildings; run with -buildings\n");
+      break;
+    }
+    DRAW_FOOTPRINTS = !DRAW_FOOTPRINTS;
+    if (!DRAW_POINTS) mark_dirty(DIRTY_GEOMETRY);
+    break;
+
+  case 'C':
+    //contours on/off
+    if (contours.size() == 0) {
+      printf("no contours; run with -contours\n");
+      break;
+    }
+    DRAW_CONTOURS = !DRAW_CONTOURS;
+    if (!DRAW_POINTS) mark_dirty(DIRTY_GEOMETRY);
+    break;
+
+  case 'j':
+    //viewshed overlay on/off
+    if (viewshed.size() == 0) {
+      printf("no viewshed; run with -viewshed or -observers\n");
+      break;
+    }
+    DRAW_VIEWSHED = !DRAW_VIEWSHED;
+    if (!DRAW_POINTS && !HILL_SHADE) mark_dirty(DIRTY_COLOR);
+    break;
+
+  case 'S':
+    //cast shadows on/off
+    CAST_SHADOWS = !CAST_SHADOWS;
+    if (CAST_SHADOWS) compute_shadows();
+    //only the hill shade shows the shadows
+    if (!DRAW_POINTS && !HILL_SHADE) mark_dirty(DIRTY_COLOR);
+    break;
+
+  case 'n':
+    //cycle through 1, 4 and 8 suns
+    SUN_DIRECTIONS = (SUN_DIRECTIONS < 4) ? 4 :
+      (SUN_DIRECTIONS < MAX_SUN_DIRECTIONS) ? MAX_SUN_DIRECTIONS : 1;
+    set_sun();
+    if (CAST_SHADOWS) compute_shadows();
+    printf("%d sun(s)\n", SUN_DIRECTIONS);
+    if (!DRAW_POINTS && (!HILL_SHADE || DRAW_TIN)) mark_dirty(DIRTY_COLOR);
+    break;
+
+  case 'p':
+    //switch between the points and the grid views
+    DRAW_POINTS = !DRAW_POINTS;
+    mark_dirty(DIRTY_GEOMETRY | DIRTY_COLOR);
+    break;
+
+  case '+':
+    //the slope threshold of the ground engine in use
+    if (GROUND_ENGINE == GROUND_PMF) {
+      PMF_SLOPE += 0.05;
+      cout << "Morphological filter slope is now: " << PMF_SLOPE << endl;
+    } else if (GROUND_ENGINE == GROUND_CSF) {
+      CSF_THRESHOLD += 0.05;
+      cout << "Cloth filter threshold is now: " << CSF_THRESHOLD << endl;
+    } else {
+      building_slope_threshold += 0.05;
+      cout << "Building slope threshold is now: " <<
+	building_slope_threshold << endl;
+    }
+
+    is_ground = classify_ground();
+    if (BUILDINGS) {
+      extract_buildings();
+      if (ROOF_PLANES) compute_roof_planes();
+      if (DRAW_FOOTPRINTS && !DRAW_POINTS) mark_dirty(DIRTY_GEOMETRY);
+    }
+    //only the ground view shows the classification
+    if (HILL_SHADE && !DRAW_POINTS) mark_dirty(DIRTY_COLOR);
+    break;
+
+  case '-':
+    //the slope threshold of the ground engine in use
+    if (GROUND_ENGINE == GROUND_PMF) {
+      PMF_SLOPE -= 0.05;
+      cout << "Morphological filter slope is now: " << PMF_SLOPE << endl;
+    } else if (GROUND_ENGINE == GROUND_CSF) {
+      CSF_THRESHOLD -= 0.05;
+      cout << "Cloth filter threshold is now: " << CSF_THRESHOLD << endl;
+    } else {
+      building_slope_threshold -= 0.05;
+      cout << "Building slope threshold is now: " <<
+	building_slope_threshold << endl;
+    }
+
+    is_ground = classify_ground();
+    if (BUILDINGS) {
+      extract_buildings();
+      if (ROOF_PLANES) compute_roof_planes();
+      if (DRAW_FOOTPRINTS && !DRAW_POINTS) mark_dirty(DIRTY_GEOMETRY);
+    }
+    //only the ground view shows the classification
+    if (HILL_SHADE && !DRAW_POINTS) mark_dirty(DIRTY_COLOR);
+    break;
+
+  case '2':
+    //3d orthogonal projection, view from straight above
+    glMatrixMode(GL_PROJECTION);
+    //the view frustrum is z=[0, -20]
+    glOrtho(-1, 1, -1, 1, 0,-20); //left, right, top, bottom, near, far
+
+    //initial view is from (0,0,-5) ie above the terrain looking straight down
+    pos[0]=pos[1]=0; pos[2] = -7;
+    //initial view: no rotation
+    theta[0]=theta[1] = theta[2]= 0;
+    mark_dirty(DIRTY_CAMERA);
+    break;
+
+  case '3':
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    gluPerspective(60, 1 /* aspect */, 1, 10.0); /* the frustrum is from z=-1 to z=-10 */
+    /* camera is at (0,0,0) looking along negative z axis */
+    //initialize the translation; view frustrum is z= [-1, -10] and
+    //initial position (0,0,-2)
+    pos[0]=pos[1]=0; pos[2] = -2;
+    //initialize rotation to look  from above
+    theta[1] = theta[2] = 0;  theta[0] = -45;
+    mark_dirty(DIRTY_CAMERA);
+    break;
+
+  case 'c':
+    //change the colormap
+    COLORMAP= (COLORMAP+1) % NB_COLORMAP_CHOICES;
+    switch (COLORMAP) {
+    case ONE_COLOR:
+      printf("colormap: one color\n");
+      break;
+    case CODE_COLOR:
+      printf("colormap: by code\n");
+      break;
+    case MYCODE_COLOR:
+      printf("colormap: by mycode\n");
+      break;
+    default:
+      printf("colormap: unknown. oops, something went wrong.\n");
+      exit(1);
+    }
+    //the colormap applies to points only
+    if (DRAW_POINTS) mark_dirty(DIRTY_COLOR);
+    break;
+
+  case 't':
+    //render points with one/more than one return
+    WHICH_RETURN = (WHICH_RETURN + 1) % NB_WHICH_RETURN_OPTIONS;
+    switch (WHICH_RETURN) {
+    case ALL_RETURN:
+      printf("draw all returns\n");
+      break;
+    case FIRST_RETURN:
+      printf("draw only first return (i.e.points with return_number=1)\n");
+      break;
+    case LAST_RETURN:
+      printf("draw only last return (i.e. points with return_number = number_of_returns)\n");
+      break;
+    case MORE_THAN_ONE_RETURN:
+      printf("draw only points that has >1 returns\n");
+      break;
+    case SINGLE_RETURN_ONLY:
+      printf("draw only single returns (i.e. points with number_of_returns = 1)\n");
+      break;
+    case INTERMEDIATE_ONLY:
+      printf("draw only intermediate returns (i.e. 1 < return_number < number_of_returns)\n");
+      break;
+    default:
+      break;
+    }
+    //the return filter applies to points only; it selects other buckets
+    if (DRAW_POINTS) mark_dirty(DIRTY_GEOMETRY);
+    break;
+
+  case 'm':
+    //cycle the ground engine: BFS, morphological filter, cloth
+    //filter, to compare them
+    GROUND_ENGINE = (GROUND_ENGINE + 1) % NB_GROUND_ENGINES;
+    printf("ground engine: %s\n",
+	   (GROUND_ENGINE == GROUND_PMF) ? "morphological filter" :
+	   (GROUND_ENGINE == GROUND_CSF) ? "cloth filter" : "BFS");
+    is_ground = classify_ground();
+    if (BUILDINGS) {
+      extract_buildings();
+      if (ROOF_PLANES) compute_roof_planes();
+      if (DRAW_FOOTPRINTS && !DRAW_POINTS) mark_dirty(DIRTY_GEOMETRY);
+    }
+    if (HILL_SHADE && !DRAW_POINTS) mark_dirty(DIRTY_COLOR);
+    break;
+
+  case 'g':
+    //toggle off rendering ground points   (code=2)
+    GROUND = !GROUND;
+    //class filters apply to points only; they select other buckets
+    if (DRAW_POINTS) mark_dirty(DIRTY_GEOMETRY);
+    break;
+
+  case 'v':
+    //toggle off rendering vegetation points  (code=3,4,5)
+    VEG = !VEG;
+    //class filters apply to points only; they select other buckets
+    if (DRAW_POINTS) mark_dirty(DIRTY_GEOMETRY);
+    break;
+
+  case 'h':
+    //toggle off rendering building points  (code=6)
+    BUILDING = !BUILDING;
+    //class filters apply to points only; they select other buckets
+    if (DRAW_POINTS) mark_dirty(DIRTY_GEOMETRY);
+    break;
+
+  case 'o':
+    //toggle off rendering "other" ie points that are not ground, vegetation or building
+    OTHER=!OTHER;
+    //class filters apply to points only; they select other buckets
+    if (DRAW_POINTS) mark_dirty(DIRTY_GEOMETRY);
+    break;
+
+    //ROTATIONS
+  case 'x':
+    theta[0] += 5.0;
+    mark_dirty(DIRTY_CAMERA);
+    break;
+  case 'y':
+    theta[1] += 5.0;
+    mark_dirty(DIRTY_CAMERA);
+    break;
+  case 'z':
+    theta[2] += 5.0;
+    mark_dirty(DIRTY_CAMERA);
+    break;
+  case 'X':
+    theta[0] -= 5.0;
+    mark_dirty(DIRTY_CAMERA);
+    break;
+  case 'Y':
+    theta[1] -= 5.0;
+    mark_dirty(DIRTY_CAMERA);
+    break;
+  case 'Z':
+    theta[2] -= 5.0;
+    mark_dirty(DIRTY_CAMERA);
+    break;
+
+    //TRANSLATIONS
+    //backward (zoom out)
+  case 'b':
+    pos[2] -= 0.1;
+    mark_dirty(DIRTY_CAMERA);
+    break;
+    //forward (zoom in)
+  case 'f':
+    pos[2] += 0.1;
+    //glTranslatef(0,0, 0.5);
+    mark_dirty(DIRTY_CAMERA);
+    break;
+    //down
+  case 'd':
+     pos[1] -= 0.1;
+    //glTranslatef(0,0.5,0);
+    mark_dirty(DIRTY_CAMERA);
+    break;
+    //up
+  case 'u':
+    pos[1] += 0.1;
+    //glTranslatef(0,-0.5,0);
+    mark_dirty(DIRTY_CAMERA);
+    break;
+    //left
+  case 'l':
+    pos[0] -= 0.1;
+    mark_dirty(DIRTY_CAMERA);
+    break;
+    //right
+  case 'r':
+    pos[0] += 0.1;
+    mark_dirty(DIRTY_CAMERA);
+    break;
+
+    //fillmode
+  case 'w':
+    fillmode = !fillmode;
+    //only the cube uses fillmode, and it is not drawn
+    break;
+
+  case 'q':
+    exit(0);
+    break;
+  }
+}//keypress
+
+
+
+
+
+
+
+
+
+/* x is a value in [minx, maxx]; it is mapped to [-1,1] */
+GLfloat xtoscreen(GLfloat x, int num_cols) {
+  //return (-1 + 2*x/WINDOWSIZE);
+  return (-1 + 2*(x)/float(num_cols));
+}
+
+
+/* y is a value in [miny, maxy]; it is mapped to [-1,1] */
+GLfloat ytoscreen(GLfloat y, int num_rows) {
+  return (-1 + 2*(y)/float(num_rows));
+}
+
+/* z is a value in [minz, maxz]; it is mapped so that [0, maxz] map to [0,1] */
+GLfloat ztoscreen(GLfloat z) {
+    return (-1 + 2*(z-minz)/(maxz-minz))/1.5;
+}
+
+
+//color based on p.code
+GLfloat* colorByCode(lidarPoint p) {
+  switch (p.code) {
+  case 0: //never classified
+    return yellow;
+  case 1: //unnasigned
+    return Orange;
+  case 2: //ground
+    //    return DarkWood;
+    return DarkBrown;
+  case 3: //low vegetation
+    return LimeGreen;
+  case 4: //medium vegetation
+    return MediumForestGreen;
+  case 5: //high vegetation
+    return ForestGreen;
+  case 6: //building
+    //return Tan;
+    return Copper;
+  case 7: //noise
+    return magenta;
+  case 8: //reserved
+    return white;
+  case 9: //water
+    return blue;
+  case 10: //rail
+    return gray;
+  case 11: //road surface
+    return gray;
+  case 12:  //reserved
+    return white;
+  case 13:
+  case 14: //wire
+    return gray;
+  case 15: //transmission tower
+    return Wheat;
+  case 16: //wire
+  case 17: //bridge deck
+    return blue;
+  case 18: //high noise
+    return magenta;
+  default:
+    printf("panic: encountered unknown code >18");
+  }
+  return white;
+} //colorByCode
+
+
+
+//put your own colormap here  based on p.mycode
+GLfloat* colorByMycode(lidarPoint p) {
+
+  return blue;
+}
+
+//draw everything with one color
+GLfloat* colorOneColor(lidarPoint p) {
+
+  return yellow; //yellow should be a constant...
+}
+
+
+
+//point p has passed all the filters and must be rendered. Return its
+//color.
+GLfloat* pointColor(lidarPoint p) {
+
+  if (COLORMAP == ONE_COLOR) {
+    //draw all points with same color
+    return colorOneColor(p);
+
+  } else if (COLORMAP == CODE_COLOR) {
+    return colorByCode(p);
+
+  } else if (COLORMAP == MYCODE_COLOR) {
+    return colorByMycode(p);
+
+  } else {
+    printf("unkown colormap options.oops.\n");
+    exit(1);
+  }
+} //pointColor()
+
+//point p has passed all the filters and must be rendered. Set its
+//color.
+void setColor(lidarPoint p) {
+  glColor3fv(pointColor(p));
+}
+
+
+//the return category of p, see RENDERING THE POINTS
+int return_category(lidarPoint p) {
+  if (p.nb_of_returns <= 1) return SINGLE_RETURN;
+  if (p.return_number == 1) return FIRST_OF_MANY;
+  if (p.return_number >= p.nb_of_returns) return LAST_OF_MANY;
+  return INTERMEDIATE_RETURN;
+}
+
+//the bucket p goes into in the point buffers
+int point_bucket(lidarPoint p) {
+  int code = (p.code >= 0 && p.code < NB_CODES) ? p.code : NB_CODES-1;
+  return return_category(p)*NB_CODES + code;
+}
+
+//1 if points of this return category pass the return filter which,
+//one of the WHICH_RETURN options
+int return_category_on(int category, int which) {
+  switch (which) {
+  case FIRST_RETURN:
+    return category == SINGLE_RETURN || category == FIRST_OF_MANY;
+  case LAST_RETURN:
+    return category == SINGLE_RETURN || category == LAST_OF_MANY;
+  case MORE_THAN_ONE_RETURN:
+    return category != SINGLE_RETURN;
+  case SINGLE_RETURN_ONLY:
+    return category == SINGLE_RETURN;
+  case INTERMEDIATE_ONLY:
+    return category == INTERMEDIATE_RETURN;
+  default:
+    return 1;
+  }
+}
+
+//1 if points with this code pass the GROUND/VEG/BUILDING/OTHER filters
+int code_on(int code) {
+  switch (code) {
+  case 2:
+    return GROUND;
+  case 3:
+  case 4:
+  case 5:
+    return VEG;
+  case 6:
+    return BUILDING;
+  default:
+    return OTHER;
+  }
+}
+
+
+/* sort the points into buckets with a counting sort, and upload their
+   screen coordinates into point_vbo in bucket order. This is done
+   once; the points don't move after they are loaded. */
+void build_point_buffers() {
+  int num_rows = elevation.size();
+  int num_cols = elevation[0].size();
+
+  //count the points in each bucket, and prefix sum the counts into
+  //the start of each bucket
+  bucket_start.assign(NB_BUCKETS+1, 0);
+  for (unsigned int i = 0; i < points.size(); i++) {
+    bucket_start[point_bucket(points[i]) + 1]++;
+  }
+  for (int b = 0; b < NB_BUCKETS; b++) {
+    bucket_start[b+1] += bucket_start[b];
+  }
+
+  //scatter the points into their buckets
+  vector<int> next(bucket_start.begin(), bucket_start.end()-1);
+  bucket_order.resize(points.size());
+  for (unsigned int i = 0; i < points.size(); i++) {
+    bucket_order[next[point_bucket(points[i])]++] = i;
+  }
+
+  //same mapping to the screen as the grid views, so that switching
+  //views keeps the terrain in place
+  vector<GLfloat> xyz(3*points.size());
+  for (unsigned int k = 0; k < bucket_order.size(); k++) {
+    lidarPoint p = points[bucket_order[k]];
+    xyz[3*k] = xtoscreen((p.y - miny)/cell_size, num_cols);
+    xyz[3*k+1] = ytoscreen((p.x - minx)/cell_size, num_rows);
+    xyz[3*k+2] = ztoscreen(p.z);
+  }
+
+  if (point_vbo == 0) glGenBuffers(1, &point_vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, point_vbo);
+  glBufferData(GL_ARRAY_BUFFER, xyz.size()*sizeof(GLfloat), &xyz[0],
+	       GL_STATIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+
+/* upload the colors of the points under the current COLORMAP into
+   color_vbo, in bucket order */
+void upload_point_colors() {
+  vector<GLfloat> rgb(3*bucket_order.size());
+  for (unsigned int k = 0; k < bucket_order.size(); k++) {
+    GLfloat* col = pointColor(points[bucket_order[k]]);
+    rgb[3*k] = col[0];
+    rgb[3*k+1] = col[1];
+    rgb[3*k+2] = col[2];
+  }
+
+  if (color_vbo == 0) glGenBuffers(1, &color_vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, color_vbo);
+  glBufferData(GL_ARRAY_BUFFER, rgb.size()*sizeof(GLfloat), &rgb[0],
+	       GL_STATIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+
+/* ****************************** */
+/* Draw the points that pass the return and class filters. Each
+   filter setting selects whole buckets; neighbouring buckets that are
+   both on are drawn with one call.
+*/
+void draw_points() {
+  if (points.size() == 0) return;
+
+  glBindBuffer(GL_ARRAY_BUFFER, point_vbo);
+  glVertexPointer(3, GL_FLOAT, 0, 0);
+  glBindBuffer(GL_ARRAY_BUFFER, color_vbo);
+  glColorPointer(3, GL_FLOAT, 0, 0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glEnableClientState(GL_COLOR_ARRAY);
+
+  int run_start = -1; //start of the current run of buckets that are on
+  for (int b = 0; b <= NB_BUCKETS; b++) {
+    int on = (b < NB_BUCKETS &&
+	      return_category_on(b / NB_CODES, WHICH_RETURN) &&
+	      code_on(b % NB_CODES));
+    if (on && run_start == -1) {
+      run_start = bucket_start[b];
+    }
+    if (!on && run_start != -1) {
+      if (bucket_start[b] > run_start) {
+	glDrawArrays(GL_POINTS, run_start, bucket_start[b] - run_start);
+      }
+      run_start = -1;
+    }
+  }
+
+  glDisableClientState(GL_COLOR_ARRAY);
+  glDisableClientState(GL_VERTEX_ARRAY);
+}//draw_points
+
+
+//calculates how bright a triangle should be, based on how much it
+//faces the sun. Uses the dot product between the incident sun vector
+//and the normal vector of the triangle.
+void hill_shade(Point p1, Point p2, Point p3, GLfloat* shade){
+  //calculate normal vector from triangle
+  Point U(p2.x - p1.x, p2.y - p1.y, p2.z - p1.z);
+  Point V(p3.x - p1.x, p3.y - p1.y, p3.z - p1.z);
+  Point N(U.y*V.z - U.z*V.y, U.z*V.x-U.x*V.z, U.x*V.y - U.y*V.x);
+
+  //normalize N:
+  float n_len = sqrt(N.x*N.x + N.y*N.y + N.z*N.z);
+  N.x = N.x/n_len;
+  N.y = N.y/n_len;
+  N.z = N.z/n_len;
+
+  //N is in (row, col, z) = (north, east, up), and faces down for the
+  //winding of draw_hill_shade
+  float up[3] = {-N.y, -N.x, -N.z};
+  float dot_product = sun_shade(up, ALL_SUNS_LIT);
+
+  shade[0] = dot_product;
+  shade[1] = dot_product;
+  shade[2] = dot_product;
+}
+
+//shade of grid cell (i,j) of elevation, from its cached normal
+void cell_shade(int i, int j, GLfloat* shade){
+  int cols = elevation[0].size();
+  int lit = CAST_SHADOWS ? cell_lit[i*cols + j] : ALL_SUNS_LIT;
+  float dot_product = sun_shade(&cell_normal[3*(i*cols + j)], lit);
+  if (SHADE_MODE != SHADE_SUN && sky_view[i][j] != NODATA) {
+    if (SHADE_MODE == SHADE_SKY) dot_product = sky_view[i][j];
+    else dot_product *= sky_view[i][j];
+  }
+
+  shade[0] = dot_product;
+  shade[1] = dot_product;
+  shade[2] = dot_product;
+
+  //tint the cells the observers see, from yellow (a few of them) to
+  //red (all of them)
+  if (DRAW_VIEWSHED && viewshed[i][j] > 0) {
+    float f = viewshed[i][j]/observers.size();
+    float a = 0.5;
+    shade[0] = (1-a)*shade[0] + a;
+    shade[1] = (1-a)*shade[1] + a*(1 - f);
+    shade[2] = (1-a)*shade[2];
+  }
+}
+
+/* ****************************** */
+/* Draw the array of points stored in global variable elevation, and
+   hill shade it.
+
+   NOTE: The points are in the range x=[minx, maxx], y=[miny,
+   maxy], z=[minz, maxz] and they must be mapped into
+   x=[-1,1], y=[-1, 1], z=[-1,1]
+  */
+void draw_hill_shade(){
+  int num_rows = elevation.size();
+  int num_cols = elevation[0].size();
+
+  //draw two triangles for each grid cell. shade with hill_shade
+  //dot product calculation.
+  glBegin(GL_TRIANGLES);
+  for (unsigned int i=0; i < elevation.size()-1; i++) {
+    for (unsigned int j=0; j < elevation[i].size()-1; j++) {
+      //get the four heights of the cell
+      float h = elevation[i][j];
+      float h_i = elevation[i+1][j];
+      float h_j = elevation[i][j+1];
+      float h_2 = elevation[i+1][j+1];
+
+      //triangle 1
+      GLfloat shade[3];
+      cell_shade(i, j, shade);
+
+      //if NODATA, make triangle a different color
+      if(h == NODATA || h_i == NODATA || h_j == NODATA){
+	h = min_elevation;
+	h_i = min_elevation;
+	h_j = min_elevation;
+	shade[0] = 1.0;
+	shade[1] = 0.0;
+	shade[2] = 0.6;
+      }
+
+      //draw triangle
+      glColor3fv(shade);
+      glVertex3f(xtoscreen(i, num_cols),
+      		 ytoscreen(j, num_rows),
+      		 ztoscreen(h));
+
+      glVertex3f(xtoscreen(i+1, num_cols),
+      		 ytoscreen(j, num_rows),
+      		 ztoscreen(h_i));
+
+      glVertex3f(xtoscreen(i, num_cols),
+      		 ytoscreen(j+1, num_rows),
+      		 ztoscreen(h_j));
+
+
+      //triangle 2
+      cell_shade(i+1, j+1, shade);
+
+      //if NODATA, make triangle a different color
+      if(h_2 == NODATA || h_i == NODATA || h_j == NODATA){
+	h_i = min_elevation;
+	h_j = min_elevation;
+	h_2 = min_elevation;
+	shade[0] = 1.0;
+	shade[1] = 0.0;
+	shade[2] = 0.6;
+      }
+
+      //draw second triangle
+      glColor3fv(shade);
+      glVertex3f(xtoscreen(i+1, num_cols),
+		 ytoscreen(j, num_rows),
+		 ztoscreen(h_i));
+
+      glVertex3f(xtoscreen(i, num_cols),
+		 ytoscreen(j+1, num_rows),
+		 ztoscreen(h_j));
+
+      glVertex3f(xtoscreen(i+1, num_cols),
+		 ytoscreen(j+1, num_rows),
+		 ztoscreen(h_2));
+    }
+  }
+  glEnd();
+}//draw_hill_shade
+
+//note to self: can make this short to save memory
+//Finds possible ground points using BFS.
+//
+//The BFS starts at the lowest unsearched point, and considers that
+//point "ground". The BFS continues in all directions, until it
+//encounters a large slope, labeling this point building. The BFS
+//continues, labeling all children of this building point building as
+//well, until it encounters a large negative slope. Upon encountering
+//this large negative slope, the BFS terminates. The BFS also
+//terminates upon encountering already classified points.
+//
+//This procedure is then repeated, starting from the next lowest
+//unsearched point, until all points are classified.
+vector<vector<int> > find_ground() {
+  int num_rows = last_grid.size();
+  int num_cols = last_grid[0].size();
+
+  //initialize everything to -1, for unvisited
+  vector<vector<int> > is_ground(num_rows, vector<int>(num_cols, -1));
+  queue<Point> q;
+
+  //keep track of number of unclassified points
+  int unclassified_count = num_rows*num_cols;
+
+  //take out nodata points
+  for (unsigned int i=0; i < last_grid.size(); i++)
+    for (unsigned int j=0; j < last_grid[i].size(); j++)
+      if (last_grid[i][j] == NODATA)
+	unclassified_count--;
+
+  //loop until all points classified
+  do {
+    //find lowest UNCLASSIFIED ground point
+    float min_height = BIGINT;
+    int min_i = 0;
+    int min_j = 0;
+    for (unsigned int i=0; i < last_grid.size(); i++) {
+      for (unsigned int j=0; j < last_grid[i].size(); j++) {
+	if (last_grid[i][j] != NODATA &&
+	    is_ground[i][j] == -1 &&
+	    last_grid[i][j] < min_height) {
+	  min_height = last_grid[i][j];
+	  min_i = i;
+	  min_j = j;
+	}
+      }
+    }
+
+    //push lowest point into queue
+    q.push(Point(min_i, min_j, min_height));
+    is_ground[min_i][min_j] = 1;
+    unclassified_count--;
+
+    //do BFS
+    while(q.size()) {
+      Point current = q.front();
+      q.pop();
+      int curr_i = current.x;
+      int curr_j = current.y;
+      float curr_h = current.z;
+
+      bool curr_type = is_ground[curr_i][curr_j];
+
+      for (int di = -1; di <= 1; ++di) {
+	for (int dj = -1; dj <= 1; ++dj) {
+	  //look in compass directions
+	  if(di != dj && (di == 0 || dj == 0)) {
+	    //check if in bounds
+	    if(curr_i + di >= 0 && curr_j + dj >= 0 &&
+	       curr_i + di < last_grid.size() &&
+	       curr_j + dj < last_grid[0].size()) {
+
+	      int new_i = curr_i + di;
+	      int new_j = curr_j + dj;
+
+	      //if point is already visited, or new point is NODATA,
+	      //terminate this branch
+	      if(is_ground[new_i][new_j] != -1 ||
+		 last_grid[new_i][new_j] == NODATA) {
+		continue;
+	      }
+
+	      float new_h = last_grid[new_i][new_j];
+	      float slope = new_h - curr_h;
+
+	      //if gentle slope, new point is same type as current point
+	      if (slope <= building_slope_threshold && slope >= 0) {
+		q.push(Point(new_i, new_j, new_h));
+		is_ground[new_i][new_j] = curr_type;
+		unclassified_count--;
+	      }
+	      //if steep upwards slope, new point is building
+	      else if (slope > building_slope_threshold) {
+		q.push(Point(new_i, new_j, new_h));
+		is_ground[new_i][new_j] = 0;
+		unclassified_count--;
+	      }
+	      //if negative slope terminate this branch
+	      else if (slope < 0){
+		continue;
+	      }
+	    }// if in bounds check
+	  }// if compass direction
+	}// dj
+      }//di
+    }// while q not empty
+  } while(unclassified_count > 0);
+  return is_ground;
+}
+
+/* ****************************** */
+/* Draw the array of points stored in global variable last_grid,
+   and shade where the ground is.
+
+   NOTE: The points are in the range x=[minx, maxx], y=[miny,
+   maxy], z=[minz, maxz] and they must be mapped into
+   x=[-1,1], y=[-1, 1], z=[-1,1]
+  */
+void draw_ground(){
+  int num_rows = last_grid.size();
+  int num_cols = last_grid[0].size();
+
+  //draw two triangles for each grid cell. shade with hill_shade
+  //dot product calculation.
+  glBegin(GL_POINTS);
+  for (unsigned int i=0; i < last_grid.size(); i++) {
+    for (unsigned int j=0; j < last_grid[i].size(); j++) {
+      float h = last_grid[i][j];
+
+      //if NODATA, make triangle a different color
+      if(h == NODATA){
+	h = min_elevation;
+	glColor3fv(magenta);
+      }
+      else if(is_ground[i][j] == 1){
+      	glColor3fv(brown);
+      }
+      else if(is_ground[i][j] == 0){
+	glColor3fv(white);
+      }
+      else if(is_ground[i][j] == -1){
+	glColor3fv(green);
+      }
+
+      glVertex3f(xtoscreen(i, num_cols),
+		 ytoscreen(j, num_rows),
+		 ztoscreen(h));
+    }
+  }
+  glEnd();
+}//draw_ground
+
+
+/* ****************************** */
+/* Draw the ground TIN built by build_ground_tin(), hill shaded. The
+   vertices are mapped to the screen like the grid and the points, so
+   switching views keeps the terrain in place.
+  */
+void draw_tin(){
+  int num_rows = elevation.size();
+  int num_cols = elevation[0].size();
+
+  glBegin(GL_TRIANGLES);
+  for (unsigned int t = 0; t < tin_triangles.size(); t += 3) {
+    //in grid coordinates, like draw_hill_shade
+    Point p[3] = {Point(0,0,0), Point(0,0,0), Point(0,0,0)};
+    for (int k = 0; k < 3; k++) {
+      float* v = &tin_xyz[3*tin_triangles[t+k]];
+      p[k] = Point((v[1] - miny)/cell_size, (v[0] - minx)/cell_size, v[2]);
+    }
+
+    //hill_shade expects the winding of the grid triangles in
+    //draw_hill_shade (clockwise in row/col); the TIN may be either way
+    float cross = (p[1].x - p[0].x)*(p[2].y - p[0].y)
+      - (p[1].y - p[0].y)*(p[2].x - p[0].x);
+    if (cross > 0) swap(p[1], p[2]);
+
+    GLfloat shade[3];
+    hill_shade(p[0], p[1], p[2], shade);
+
+    glColor3fv(shade);
+    for (int k = 0; k < 3; k++) {
+      glVertex3f(xtoscreen(p[k].x, num_cols),
+		 ytoscreen(p[k].y, num_rows),
+		 ztoscreen(p[k].z));
+    }
+  }
+  glEnd();
+}//draw_tin
+
+
+/* ****************************** */
+/* Draw the contours over the grid views, the lines at the multiples
+   of the largest interval thicker and red, the others yellow. They
+   are lifted a little above the surface, which they would otherwise
+   cut in and out of.
+  */
+void draw_contours(){
+  int num_rows = elevation.size();
+  int num_cols = elevation[0].size();
+  GLfloat lift = 0.005;
+
+  for (unsigned int k = 0; k < contours.size(); k++) {
+    contourLine& line = contours[k];
+    glLineWidth(line.major ? 2 : 1);
+    glColor3fv(line.major ? red : yellow);
+    glBegin(GL_LINE_STRIP);
+    for (unsigned int p = 0; p < line.pts.size(); p += 2) {
+      glVertex3f(xtoscreen(line.pts[p], num_cols),
+		 ytoscreen(line.pts[p+1], num_rows),
+		 ztoscreen(line.level) + lift);
+    }
+    glEnd();
+  }
+  glLineWidth(1);
+}//draw_contours
+
+
+/* ****************************** */
+/* Draw the footprints of the buildings, in cyan, at the mean height
+   of their roofs.
+  */
+void draw_footprints(){
+  int num_rows = elevation.size();
+  int num_cols = elevation[0].size();
+
+  glLineWidth(2);
+  glColor3fv(cyan);
+  for (unsigned int b = 0; b < buildings.size(); b++) {
+    vector<float>& fp = buildings[b].footprint;
+    glBegin(GL_LINE_LOOP);
+    for (unsigned int k = 0; k < fp.size(); k += 2) {
+      //from map to grid coordinates, rows along y
+      glVertex3f(xtoscreen((fp[k+1] - miny)/cell_size, num_cols),
+		 ytoscreen((fp[k] - minx)/cell_size, num_rows),
+		 ztoscreen(buildings[b].roof_z));
+    }
+    glEnd();
+  }
+  glLineWidth(1);
+}//draw_footprints
+
+//draw a square x=[-side,side] x y=[-side,side] at depth z
+void draw_xy_rect(GLfloat z, GLfloat side, GLfloat* col) {
+
+  glColor3fv(col);
+  glBegin(GL_POLYGON);
+  glVertex3f(-side,-side, z);
+  glVertex3f(-side,side, z);
+  glVertex3f(side,side, z);
+  glVertex3f(side,-side, z);
+  glEnd();
+}
+
+
+//draw a square y=[-side,side] x z=[-side,side] at given x
+void draw_yz_rect(GLfloat x, GLfloat side, GLfloat* col) {
+
+  glColor3fv(col);
+  glBegin(GL_POLYGON);
+  glVertex3f(x,-side, side);
+  glVertex3f(x,side, side);
+  glVertex3f(x,side, -side);
+  glVertex3f(x,-side, -side);
+  glEnd();
+}
+
+
+//draw a square x=[-side,side] x z=[-side,side] at given y
+void draw_xz_rect(GLfloat y, GLfloat side, GLfloat* col) {
+
+  glColor3fv(col);
+  glBegin(GL_POLYGON);
+  glVertex3f(-side,y, side);
+  glVertex3f(-side,y, -side);
+  glVertex3f(side,y, -side);
+  glVertex3f(side,y, side);
+  glEnd();
+}
+
+//draw a cube
+void cube(GLfloat side) {
+  GLfloat f = side, b = -side;
+
+  if (fillmode) {
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+  } else {
+    glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+  }
+
+
+  /* back face  BLUE*/
+  draw_xy_rect(b,side, blue);
+ /* front face  RED*/
+  draw_xy_rect(f,side, red);
+  /* side faces  GREEN*/
+  draw_yz_rect(b, side, green);
+  draw_yz_rect(f, side, green);
+  //up, down faces missing to be able to see inside
+
+  /* middle z=0 face CYAN*/
+  draw_xy_rect(0, side, cyan);
+  /* middle x=0 face WHITE*/
+  draw_yz_rect(0,side, gray);
+  /* middle y=0 face  pink*/
+  draw_xz_rect(0, side, magenta);
+}
+
+
+
+//draw a filled cube  [-side,side]^3
+void filledcube(GLfloat side) {
+
+  glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+  /* back, front faces */
+  draw_xy_rect(-side,side, yellow);
+  draw_xy_rect(side,side, yellow);
+
+  /* left, right faces*/
+  draw_yz_rect(-side, side, yellow);
+  draw_yz_rect(side, side, yellow);
+
+  /* up, down  faces  */
+  draw_xz_rect(side,side, yellow);
+  draw_xz_rect(-side,side, yellow);
+}